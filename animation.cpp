@@ -0,0 +1,108 @@
+#include "animation.h"
+
+// Map an animation file and check its header. Returns false (and prints why) if it isn't usable.
+unsigned char openAnimation(const char *path, Animation_t *anim) {
+	struct stat st;
+	int fd;
+
+	memset(anim, 0, sizeof(Animation_t));
+
+	if((fd = open(path, O_RDONLY)) < 0) {
+		printf("Unable to open %s\n", path);
+		return false;
+	}
+	if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(AnimationHeader_t)) {
+		printf("%s is not an animation file\n", path);
+		close(fd);
+		return false;
+	}
+
+	anim->mapSize = st.st_size;
+	anim->map = mmap(NULL, anim->mapSize, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(anim->map == MAP_FAILED) {
+		printf("Unable to map %s\n", path);
+		anim->map = NULL;
+		return false;
+	}
+
+	anim->header = (const AnimationHeader_t *)anim->map;
+	anim->frames = (const unsigned int *)((const char *)anim->map + sizeof(AnimationHeader_t));
+
+	if(memcmp(anim->header->magic, ANIMATION_MAGIC, 4) != 0 || anim->header->version != ANIMATION_VERSION) {
+		printf("%s is not a version %d animation file\n", path, ANIMATION_VERSION);
+		closeAnimation(anim);
+		return false;
+	}
+	// Worked out in 64 bits, so a huge LED or frame count can't wrap around and pass
+	uint32_t numLEDs = anim->header->numLEDs;
+	uint32_t frameLength = anim->header->frameLength;
+	if(numLEDs == 0 || frameLength == 0 ||
+	   frameLength != ((uint64_t)numLEDs * 24 * SYMBOL_BITS_3 + 31) / 32 ||
+	   (uint64_t)frameLength * anim->header->numFrames > (anim->mapSize - sizeof(AnimationHeader_t)) / sizeof(unsigned int)) {
+		printf("%s is truncated or corrupt\n", path);
+		closeAnimation(anim);
+		return false;
+	}
+
+	// Frames are read once, front to back
+	madvise(anim->map, anim->mapSize, MADV_SEQUENTIAL);
+	return true;
+}
+
+void closeAnimation(Animation_t *anim) {
+	if(anim->map != NULL) {
+		munmap(anim->map, anim->mapSize);
+	}
+	memset(anim, 0, sizeof(Animation_t));
+}
+
+// Start writing an animation file. The frame count is filled in by finishAnimation().
+unsigned char createAnimation(const char *path, unsigned int numLEDs, unsigned int frameIntervalUs, AnimationWriter_t *writer) {
+	memset(writer, 0, sizeof(AnimationWriter_t));
+	memcpy(writer->header.magic, ANIMATION_MAGIC, 4);
+	writer->header.version = ANIMATION_VERSION;
+	writer->header.numLEDs = numLEDs;
+	writer->header.frameIntervalUs = frameIntervalUs;
+	writer->header.frameLength = WIRE_WORDS(numLEDs);
+
+	if((writer->file = fopen(path, "wb")) == NULL) {
+		printf("Unable to create %s\n", path);
+		return false;
+	}
+	if(fwrite(&writer->header, sizeof(AnimationHeader_t), 1, writer->file) != 1) {
+		printf("Unable to write %s\n", path);
+		fclose(writer->file);
+		writer->file = NULL;
+		return false;
+	}
+	return true;
+}
+
+// Append one frame of header.frameLength wire words
+unsigned char writeAnimationFrame(AnimationWriter_t *writer, const unsigned int *wire) {
+	if(fwrite(wire, sizeof(unsigned int), writer->header.frameLength, writer->file) != writer->header.frameLength) {
+		printf("Unable to write frame %d\n", writer->header.numFrames);
+		return false;
+	}
+	writer->header.numFrames++;
+	return true;
+}
+
+// Write the final header and close the file
+unsigned char finishAnimation(AnimationWriter_t *writer) {
+	unsigned char ok = true;
+
+	if(fseek(writer->file, 0, SEEK_SET) != 0 ||
+	   fwrite(&writer->header, sizeof(AnimationHeader_t), 1, writer->file) != 1) {
+		ok = false;
+	}
+	if(fclose(writer->file) != 0) {
+		ok = false;
+	}
+	writer->file = NULL;
+	if(!ok) {
+		printf("Unable to finish animation file\n");
+	}
+	return ok;
+}
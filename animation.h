@@ -0,0 +1,57 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <stdint.h>
+#include "ws2812b.h"
+
+// Pre-encoded animation files
+// -------------------------------------------------------------------------------------------------
+// A header followed by numFrames frames of frameLength 32-bit words each. The words are exactly
+// what show() hands to PWM_FIF1 (see encoder.h), stored little-endian like the Pi itself, so a
+// player only has to mmap the file and point the transmit path at each frame in turn.
+//
+//   offset  size  field
+//        0     4  magic "WS2B"
+//        4     4  version (ANIMATION_VERSION)
+//        8     4  numLEDs
+//       12     4  numFrames
+//       16     4  frameIntervalUs (0: as fast as the wire allows)
+//       20     4  frameLength, in words (WIRE_WORDS(numLEDs))
+//       24     8  reserved, zero
+//       32        frame data
+
+#define ANIMATION_MAGIC   "WS2B"
+#define ANIMATION_VERSION 1
+
+typedef struct AnimationHeader_t {
+	char magic[4];
+	uint32_t version;
+	uint32_t numLEDs;
+	uint32_t numFrames;
+	uint32_t frameIntervalUs;
+	uint32_t frameLength;
+	uint32_t reserved[2];
+} AnimationHeader_t;
+
+// An animation file mapped into memory
+typedef struct Animation_t {
+	const AnimationHeader_t *header;
+	const unsigned int *frames;     // Frame n starts at frames[n * header->frameLength]
+	void *map;
+	size_t mapSize;
+} Animation_t;
+
+// An animation file being written
+typedef struct AnimationWriter_t {
+	FILE *file;
+	AnimationHeader_t header;
+} AnimationWriter_t;
+
+unsigned char openAnimation(const char *path, Animation_t *anim);
+void closeAnimation(Animation_t *anim);
+
+unsigned char createAnimation(const char *path, unsigned int numLEDs, unsigned int frameIntervalUs, AnimationWriter_t *writer);
+unsigned char writeAnimationFrame(AnimationWriter_t *writer, const unsigned int *wire);
+unsigned char finishAnimation(AnimationWriter_t *writer);
+
+#endif // ANIMATION_H
@@ -0,0 +1,324 @@
+#include "effects.h"
+
+void initLayer(EffectLayer_t *layer, unsigned char effect, unsigned int first, unsigned int count) {
+	memset(layer, 0, sizeof(EffectLayer_t));
+	layer->effect = effect;
+	layer->blend = BLEND_NORMAL;
+	layer->opacity = 255;
+	layer->enabled = true;
+	layer->first = first;
+	layer->count = count;
+	layer->color1.r = layer->color1.g = layer->color1.b = 255;
+	layer->period = count;
+	layer->width = 1;
+}
+
+// Render with the calling thread and up to workerCount more (at most EFFECT_MAX_WORKERS). With
+// four cores and the output thread on one of them, two or three workers is about right.
+EffectEngine::EffectEngine(ws2812b *output, unsigned int leds, unsigned int workerCount) {
+	unsigned int i;
+
+	strip = output;
+	numLEDs = leds;
+	numLayers = 0;
+	memset(layers, 0, sizeof(layers));
+	memset(phase, 0, sizeof(phase));
+	memset(&stats, 0, sizeof(stats));
+	target = NULL;
+	runLength = 0;
+
+	pthread_mutex_init(&poolLock, NULL);
+	pthread_cond_init(&startCond, NULL);
+	pthread_cond_init(&doneCond, NULL);
+	generation = 0;
+	running = 0;
+	stopping = false;
+
+	if(workerCount > EFFECT_MAX_WORKERS) {
+		workerCount = EFFECT_MAX_WORKERS;
+	}
+	for(i=0; i<workerCount; i++) {
+		workers[i].engine = this;
+		workers[i].run = i + 1;
+		if(pthread_create(&workers[i].thread, NULL, workerEntry, &workers[i]) != 0) {
+			printf("Unable to start effect worker %d, rendering with %d\n", i, i);
+			break;
+		}
+	}
+	numWorkers = i;
+}
+
+EffectEngine::~EffectEngine() {
+	unsigned int i;
+
+	pthread_mutex_lock(&poolLock);
+	stopping = true;
+	pthread_cond_broadcast(&startCond);
+	pthread_mutex_unlock(&poolLock);
+	for(i=0; i<numWorkers; i++) {
+		pthread_join(workers[i].thread, NULL);
+	}
+
+	pthread_cond_destroy(&doneCond);
+	pthread_cond_destroy(&startCond);
+	pthread_mutex_destroy(&poolLock);
+}
+
+unsigned char EffectEngine::validLayer(const EffectLayer_t *layer) {
+	if(layer->effect > EFFECT_CHASE || layer->blend > BLEND_LIGHTEN) {
+		printf("Unknown effect %d or blend mode %d\n", layer->effect, layer->blend);
+		return false;
+	}
+	if(layer->first > numLEDs || layer->count > numLEDs - layer->first) {
+		printf("Layer covers LEDs %d-%d (don't have that many LEDs!)\n", layer->first, layer->first + layer->count - 1);
+		return false;
+	}
+	if((layer->effect == EFFECT_RAINBOW || layer->effect == EFFECT_CHASE) && layer->period == 0) {
+		printf("A rainbow or chase layer needs a period\n");
+		return false;
+	}
+	return true;
+}
+
+// Put a layer on top of the stack. Returns its index, or -1.
+int EffectEngine::addLayer(const EffectLayer_t *layer) {
+	if(numLayers == EFFECT_MAX_LAYERS) {
+		printf("Unable to add a layer (only %d allowed)\n", EFFECT_MAX_LAYERS);
+		return -1;
+	}
+	if(!validLayer(layer)) {
+		return -1;
+	}
+	layers[numLayers] = *layer;
+	return numLayers++;
+}
+
+// Replace a layer, to change its colors, speed, opacity and so on from one frame to the next
+unsigned char EffectEngine::setLayer(unsigned int index, const EffectLayer_t *layer) {
+	if(index >= numLayers) {
+		printf("No layer %d\n", index);
+		return false;
+	}
+	if(!validLayer(layer)) {
+		return false;
+	}
+	layers[index] = *layer;
+	return true;
+}
+
+void EffectEngine::clearLayers() {
+	numLayers = 0;
+}
+
+// Hue 0-255 around the color wheel, as in neo-test
+static inline Color_t wheel(unsigned int hue) {
+	Color_t color;
+	if(hue < 85) {
+		color.r = hue * 3;
+		color.g = 255 - hue * 3;
+		color.b = 0;
+	} else if(hue < 170) {
+		hue -= 85;
+		color.r = 255 - hue * 3;
+		color.g = 0;
+		color.b = hue * 3;
+	} else {
+		hue -= 170;
+		color.r = 0;
+		color.g = hue * 3;
+		color.b = 255 - hue * 3;
+	}
+	return color;
+}
+
+static inline unsigned char blendChannel(unsigned int under, unsigned int over, unsigned char mode, unsigned int opacity) {
+	unsigned int result;
+	switch(mode) {
+		case BLEND_ADD:
+			result = under + over > 255 ? 255 : under + over;
+			break;
+		case BLEND_MULTIPLY:
+			result = (under * over + 127) / 255;
+			break;
+		case BLEND_SCREEN:
+			result = 255 - ((255 - under) * (255 - over) + 127) / 255;
+			break;
+		case BLEND_LIGHTEN:
+			result = over > under ? over : under;
+			break;
+		default:
+			result = over;
+			break;
+	}
+	if(opacity == 255) {
+		return result;
+	}
+	return (under * (255 - opacity) + result * opacity + 127) / 255;
+}
+
+static inline void blendPixel(Color_t *under, Color_t over, unsigned char mode, unsigned int opacity) {
+	under->r = blendChannel(under->r, over.r, mode, opacity);
+	under->g = blendChannel(under->g, over.g, mode, opacity);
+	under->b = blendChannel(under->b, over.b, mode, opacity);
+}
+
+// Composite every layer into target[first] to target[end-1]
+void EffectEngine::renderRange(unsigned int first, unsigned int end) {
+	unsigned int l, i, a, b, p, cycle, offset;
+	Color_t *out = target;
+
+	memset(out + first, 0, (end - first) * sizeof(Color_t));
+
+	for(l=0; l<numLayers; l++) {
+		const EffectLayer_t *layer = &layers[l];
+		unsigned char mode = layer->blend;
+		unsigned int opacity = layer->opacity;
+
+		// The part of this run the layer covers
+		a = layer->first > first ? layer->first : first;
+		b = layer->first + layer->count < end ? layer->first + layer->count : end;
+		if(!layer->enabled || opacity == 0 || a >= b) {
+			continue;
+		}
+
+		switch(layer->effect) {
+			case EFFECT_SOLID:
+				for(i=a; i<b; i++) {
+					blendPixel(&out[i], layer->color1, mode, opacity);
+				}
+				break;
+
+			case EFFECT_GRADIENT: {
+				int dr = layer->color2.r - layer->color1.r;
+				int dg = layer->color2.g - layer->color1.g;
+				int db = layer->color2.b - layer->color1.b;
+				int last = layer->count > 1 ? layer->count - 1 : 1;
+				for(i=a; i<b; i++) {
+					int at = i - layer->first;
+					Color_t color;
+					color.r = layer->color1.r + dr * at / last;
+					color.g = layer->color1.g + dg * at / last;
+					color.b = layer->color1.b + db * at / last;
+					blendPixel(&out[i], color, mode, opacity);
+				}
+				break;
+			}
+
+			case EFFECT_RAINBOW:
+				// Hue in 1/256 LEDs along the cycle, shifted back by how far it has moved
+				cycle = layer->period * 256;
+				offset = cycle - phase[l];
+				for(i=a; i<b; i++) {
+					p = ((i - layer->first) * 256 + offset) % cycle;
+					blendPixel(&out[i], wheel(p / layer->period), mode, opacity);
+				}
+				break;
+
+			case EFFECT_CHASE:
+				offset = layer->period - phase[l] / 256;
+				for(i=a; i<b; i++) {
+					p = (i - layer->first + offset) % layer->period;
+					blendPixel(&out[i], p < layer->width ? layer->color1 : layer->color2, mode, opacity);
+				}
+				break;
+		}
+	}
+}
+
+void EffectEngine::renderRun(unsigned int run) {
+	unsigned int first = run * runLength;
+	if(first >= numLEDs) {
+		return;
+	}
+	renderRange(first, first + runLength < numLEDs ? first + runLength : numLEDs);
+}
+
+void *EffectEngine::workerEntry(void *arg) {
+	Worker_t *worker = (Worker_t *)arg;
+	worker->engine->workerLoop(worker->run);
+	return NULL;
+}
+
+// Render this worker's run of every frame render() hands out, until the engine is deleted
+void EffectEngine::workerLoop(unsigned int run) {
+	unsigned long done = 0;
+
+	pthread_mutex_lock(&poolLock);
+	while(true) {
+		while(!stopping && generation == done) {
+			pthread_cond_wait(&startCond, &poolLock);
+		}
+		if(stopping) {
+			break;
+		}
+		done = generation;
+		pthread_mutex_unlock(&poolLock);
+
+		renderRun(run);
+
+		pthread_mutex_lock(&poolLock);
+		if(--running == 0) {
+			pthread_cond_signal(&doneCond);
+		}
+	}
+	pthread_mutex_unlock(&poolLock);
+}
+
+// Render the layers as they are at timeNs (on any clock, as long as it's the same one every
+// frame) into the strip's LED buffer and mark it changed, ready for show() or showAsync()
+void EffectEngine::render(unsigned long long timeNs) {
+	unsigned long long start = monotonicNs();
+	unsigned int l, runs, chunks;
+
+	// Where each moving layer has got to, in 1/256 LEDs within one period
+	for(l=0; l<numLayers; l++) {
+		if(layers[l].effect == EFFECT_RAINBOW || layers[l].effect == EFFECT_CHASE) {
+			double cycle = layers[l].period * 256.0;
+			double moved = fmod(layers[l].speed * (timeNs / 1e9) * 256.0, cycle);
+			phase[l] = (long long)(moved < 0 ? moved + cycle : moved) % (long long)cycle;
+		}
+	}
+
+	// showAsync() swaps the LED buffer, so it's fetched every frame
+	target = strip->pixelBuffer();
+
+	runs = numWorkers + 1;
+	chunks = (numLEDs + EFFECT_CHUNK_LEDS - 1) / EFFECT_CHUNK_LEDS;
+	if(numWorkers == 0 || chunks < 2) {
+		runLength = numLEDs;
+		renderRange(0, numLEDs);
+	} else {
+		runLength = (chunks + runs - 1) / runs * EFFECT_CHUNK_LEDS;
+
+		pthread_mutex_lock(&poolLock);
+		running = numWorkers;
+		generation++;
+		pthread_cond_broadcast(&startCond);
+		pthread_mutex_unlock(&poolLock);
+
+		renderRun(0);
+
+		pthread_mutex_lock(&poolLock);
+		while(running > 0) {
+			pthread_cond_wait(&doneCond, &poolLock);
+		}
+		pthread_mutex_unlock(&poolLock);
+	}
+
+	strip->pixelsChanged(0, numLEDs);
+
+	unsigned long long elapsed = monotonicNs() - start;
+	pthread_mutex_lock(&poolLock);
+	stats.frames++;
+	stats.renderNs += elapsed;
+	if(elapsed > stats.renderMaxNs) {
+		stats.renderMaxNs = elapsed;
+	}
+	pthread_mutex_unlock(&poolLock);
+}
+
+void EffectEngine::getStats(EffectStats_t *out) {
+	pthread_mutex_lock(&poolLock);
+	*out = stats;
+	pthread_mutex_unlock(&poolLock);
+}
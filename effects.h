@@ -0,0 +1,115 @@
+#ifndef EFFECTS_H
+#define EFFECTS_H
+
+#include "ws2812b.h"
+
+// Effects engine
+// -------------------------------------------------------------------------------------------------
+// Renders a stack of effect layers (solid, gradient, rainbow, chase) straight into the strip's LED
+// buffer, bottom layer first, each blended onto what's under it. The chain is cut into one run of
+// LEDs per thread and every thread composites all the layers for its run, so a frame is rendered
+// by the calling thread and a small pool of workers side by side. Nothing is copied: each thread
+// writes its own part of pixelBuffer() and render() then marks the whole chain changed.
+//
+// Runs are multiples of EFFECT_CHUNK_LEDS, so no two threads write the same cache line, and short
+// chains are rendered on the calling thread alone, where waking workers would cost more than it
+// saves. Layers may only be changed between render() calls, from the thread calling render().
+//
+//   EffectEngine effects(strip, numLEDs, 3);
+//   EffectLayer_t layer;
+//   initLayer(&layer, EFFECT_RAINBOW, 0, numLEDs);
+//   effects.addLayer(&layer);
+//   effects.render(monotonicNs());
+//   strip->show();
+
+// Effects
+#define EFFECT_SOLID    0       // color1
+#define EFFECT_GRADIENT 1       // color1 at the first LED to color2 at the last
+#define EFFECT_RAINBOW  2       // A hue cycle every period LEDs
+#define EFFECT_CHASE    3       // width LEDs of color1 every period LEDs, on color2
+
+// How a layer is blended onto the layers under it. The result is then mixed with what was there
+// by the layer's opacity.
+#define BLEND_NORMAL    0       // The layer's color
+#define BLEND_ADD       1       // Sum, clipped at 255
+#define BLEND_MULTIPLY  2       // Product: darkens
+#define BLEND_SCREEN    3       // Inverse of the product of the inverses: lightens
+#define BLEND_LIGHTEN   4       // The brighter of the two, per channel
+
+#define EFFECT_MAX_LAYERS       8
+#define EFFECT_MAX_WORKERS      8
+#define EFFECT_CHUNK_LEDS       64      // 192 bytes, three cache lines
+
+typedef struct EffectLayer_t {
+	unsigned char effect;           // EFFECT_*
+	unsigned char blend;            // BLEND_*
+	unsigned char opacity;          // 0-255
+	unsigned char enabled;
+	unsigned int first;             // LEDs first to first+count-1 are covered
+	unsigned int count;
+	Color_t color1;
+	Color_t color2;
+	unsigned int period;            // Rainbow and chase: LEDs before the pattern repeats
+	unsigned int width;             // Chase: LEDs lit in each period
+	int speed;                      // Rainbow and chase: LEDs per second the pattern moves along
+} EffectLayer_t;
+
+typedef struct EffectStats_t {
+	unsigned long frames;           // Frames rendered
+	unsigned long long renderNs;    // Time spent in render()
+	unsigned long long renderMaxNs;
+} EffectStats_t;
+
+// A layer of the given effect over LEDs first to first+count-1: opaque, blended normally, white
+// on black, and for the moving effects a period of count LEDs, width 1 and speed 0
+void initLayer(EffectLayer_t *layer, unsigned char effect, unsigned int first, unsigned int count);
+
+class EffectEngine {
+	public:
+		EffectEngine(ws2812b *output, unsigned int leds, unsigned int workerCount);
+		~EffectEngine();
+
+		int addLayer(const EffectLayer_t *layer);
+		unsigned char setLayer(unsigned int index, const EffectLayer_t *layer);
+		void clearLayers();
+
+		void render(unsigned long long timeNs);
+		void getStats(EffectStats_t *out);
+
+	private:
+		ws2812b *strip;
+		unsigned int numLEDs;
+
+		EffectLayer_t layers[EFFECT_MAX_LAYERS];
+		unsigned int numLayers;
+		long long phase[EFFECT_MAX_LAYERS];     // How far each layer has moved, in 1/256 LEDs
+
+		// Worker pool. The calling thread renders run 0 and each worker the run it was given.
+		typedef struct Worker_t {
+			EffectEngine *engine;
+			unsigned int run;
+			pthread_t thread;
+		} Worker_t;
+		Worker_t workers[EFFECT_MAX_WORKERS];
+		unsigned int numWorkers;
+		pthread_mutex_t poolLock;
+		pthread_cond_t startCond;
+		pthread_cond_t doneCond;
+		unsigned long generation;       // Bumped for every frame handed to the workers
+		unsigned int running;           // Workers still rendering the current frame
+		unsigned char stopping;
+
+		// The frame being rendered
+		Color_t *target;
+		unsigned int runLength;         // LEDs per run, a multiple of EFFECT_CHUNK_LEDS
+
+		EffectStats_t stats;
+
+		unsigned char validLayer(const EffectLayer_t *layer);
+		void renderRange(unsigned int first, unsigned int end);
+		void renderRun(unsigned int run);
+		static void *workerEntry(void *arg);
+		void workerLoop(unsigned int run);
+};
+
+#endif // EFFECTS_H
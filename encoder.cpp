@@ -0,0 +1,230 @@
+// System headers first: ws2812b.h defines true and false
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#if !defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#elif defined(NEON_SHIM)
+#include "neonshim.h"
+#endif
+
+#include "encoder.h"
+
+// 24-bit (or with 4-bit symbols, 32-bit) wire pattern of a color byte
+static unsigned int wirePattern(unsigned char value, unsigned int symbolBits) {
+	unsigned int pattern = 0;
+	int i;
+	for(i=7; i>=0; i--) {
+		if(symbolBits == SYMBOL_BITS_4) {
+			// 0b1110 = High, High, High, Low; 0b1000 = High, Low, Low, Low
+			pattern = (pattern << 4) | ((value & (1 << i)) ? 0xE : 0x8);
+		} else {
+			// 0b110 = High, High, Low; 0b100 = High, Low, Low
+			pattern = (pattern << 3) | ((value & (1 << i)) ? 0x6 : 0x4);
+		}
+	}
+	return pattern;
+}
+
+void buildWireTable(WireTable_t *table, unsigned int symbolBits) {
+	buildCorrectedWireTable(table, NULL, NULL, NULL, symbolBits);
+}
+
+void buildCorrectedWireTable(WireTable_t *table, const unsigned char *r, const unsigned char *g, const unsigned char *b,
+                             unsigned int symbolBits) {
+	int value;
+	for(value=0; value<256; value++) {
+		table->r[value] = wirePattern(r ? r[value] : value, symbolBits);
+		table->g[value] = wirePattern(g ? g[value] : value, symbolBits);
+		table->b[value] = wirePattern(b ? b[value] : value, symbolBits);
+	}
+	table->symbolBits = symbolBits;
+}
+
+void encodeWire(const WireTable_t *table, const Color_t *pixels, unsigned int count, unsigned int *out) {
+	unsigned int i;
+
+	// With 4-bit symbols every color byte is one word
+	if(table->symbolBits == SYMBOL_BITS_4) {
+		for(i=0; i<count; i++, out+=3) {
+			out[0] = table->g[pixels[i].g];
+			out[1] = table->r[pixels[i].r];
+			out[2] = table->b[pixels[i].b];
+		}
+		return;
+	}
+
+	// Four LEDs are twelve color bytes, which is nine whole words
+	for(i=0; i+4<=count; i+=4, pixels+=4, out+=9) {
+		PACK4(table->g[pixels[0].g], table->r[pixels[0].r], table->b[pixels[0].b], table->g[pixels[1].g], out);
+		PACK4(table->r[pixels[1].r], table->b[pixels[1].b], table->g[pixels[2].g], table->r[pixels[2].r], out + 3);
+		PACK4(table->b[pixels[2].b], table->g[pixels[3].g], table->r[pixels[3].r], table->b[pixels[3].b], out + 6);
+	}
+
+	// 1-3 LEDs left over. Pad with empty patterns (not a table entry, which is never all zeros) and only
+	// copy out the words that hold real data.
+	if(i < count) {
+		unsigned int t[12] = { 0 };
+		unsigned int tail[9];
+		unsigned int j, n = count - i;
+		for(j=0; j<n; j++) {
+			t[j*3 + 0] = table->g[pixels[j].g];
+			t[j*3 + 1] = table->r[pixels[j].r];
+			t[j*3 + 2] = table->b[pixels[j].b];
+		}
+		PACK4(t[0], t[1], t[2], t[3], tail);
+		PACK4(t[4], t[5], t[6], t[7], tail + 3);
+		PACK4(t[8], t[9], t[10], t[11], tail + 6);
+		memcpy(out, tail, WIRE_WORDS(n) * sizeof(unsigned int));
+	}
+}
+
+// Correct one 16-bit channel value and dither it down to 8 bits
+static inline unsigned char ditherChannel(const DitherCurve_t *curve, unsigned int c, unsigned int value, unsigned char *error) {
+	unsigned int hi = value >> 8;
+	unsigned int v = curve->gamma[hi] + (((curve->gamma[hi + 1] - curve->gamma[hi]) * (value & 0xFF)) >> 8);
+	v = ((v * curve->scale[c]) >> 16) + *error;
+	*error = v & 0xFF;
+	v >>= 8;
+	return v > 255 ? 255 : v;
+}
+
+void encodeWireDithered(const WireTable_t *table, const DitherCurve_t *curve, const Color16_t *pixels,
+                        unsigned char *error, unsigned int count, unsigned int *out) {
+	unsigned int i, j, n;
+	unsigned int t[12];
+	unsigned int tail[9];
+
+	if(table->symbolBits == SYMBOL_BITS_4) {
+		for(i=0; i<count; i++, error+=3, out+=3) {
+			out[0] = table->g[ditherChannel(curve, 1, pixels[i].g, error + 1)];
+			out[1] = table->r[ditherChannel(curve, 0, pixels[i].r, error + 0)];
+			out[2] = table->b[ditherChannel(curve, 2, pixels[i].b, error + 2)];
+		}
+		return;
+	}
+
+	// Four LEDs at a time, as in encodeWire(). Past the last LED the patterns are empty.
+	for(i=0; i<count; i+=4, pixels+=4, error+=12, out+=9) {
+		n = count - i < 4 ? count - i : 4;
+		for(j=0; j<n; j++) {
+			t[j*3 + 0] = table->g[ditherChannel(curve, 1, pixels[j].g, error + j*3 + 1)];
+			t[j*3 + 1] = table->r[ditherChannel(curve, 0, pixels[j].r, error + j*3 + 0)];
+			t[j*3 + 2] = table->b[ditherChannel(curve, 2, pixels[j].b, error + j*3 + 2)];
+		}
+		for(j=n*3; j<12; j++) {
+			t[j] = 0;
+		}
+		if(n == 4) {
+			PACK4(t[0], t[1], t[2], t[3], out);
+			PACK4(t[4], t[5], t[6], t[7], out + 3);
+			PACK4(t[8], t[9], t[10], t[11], out + 6);
+		} else {
+			PACK4(t[0], t[1], t[2], t[3], tail);
+			PACK4(t[4], t[5], t[6], t[7], tail + 3);
+			PACK4(t[8], t[9], t[10], t[11], tail + 6);
+			memcpy(out, tail, WIRE_WORDS(n) * sizeof(unsigned int));
+		}
+	}
+}
+
+#ifdef ENCODER_NEON_KERNEL
+
+// A color byte v becomes the wire bytes 0x924924 | (bit i of v moved to bit 3i + 1). Each of the
+// three bytes only depends on a few bits of v, so each is an 8-entry vtbl lookup:
+// the first on bits 7-5, the second on bits 4-3, the third on bits 2-0.
+static const uint8_t neonFirst[8] = { 0x92, 0x93, 0x9a, 0x9b, 0xd2, 0xd3, 0xda, 0xdb };
+static const uint8_t neonSecond[8] = { 0x49, 0x4d, 0x69, 0x6d, 0, 0, 0, 0 };
+static const uint8_t neonThird[8] = { 0x24, 0x26, 0x34, 0x36, 0xa4, 0xa6, 0xb4, 0xb6 };
+
+void encodeWireNEON(const WireTable_t *table, const Color_t *pixels, unsigned int count, unsigned int *out) {
+	const uint8x8_t first = vld1_u8(neonFirst);
+	const uint8x8_t second = vld1_u8(neonSecond);
+	const uint8x8_t third = vld1_u8(neonThird);
+	const uint8x8_t three = vdup_n_u8(3);
+	const uint8x8_t seven = vdup_n_u8(7);
+	uint8_t grb[24];
+	unsigned int i, j;
+
+	// Eight LEDs are 24 color bytes, which is 72 wire bytes or 18 whole words
+	for(i=0; i+8<=count; i+=8, pixels+=8, out+=18) {
+		uint8_t *wire = (uint8_t *)out;
+
+		// R, G, B in memory -> G, R, B as they go out on the wire
+		uint8x8x3_t rgb = vld3_u8((const uint8_t *)pixels);
+		uint8x8x3_t swapped;
+		swapped.val[0] = rgb.val[1];
+		swapped.val[1] = rgb.val[0];
+		swapped.val[2] = rgb.val[2];
+		vst3_u8(grb, swapped);
+
+		// Expand every color byte into its three wire bytes, in wire order
+		for(j=0; j<3; j++) {
+			uint8x8_t c = vld1_u8(grb + j*8);
+			uint8x8x3_t bytes;
+			bytes.val[0] = vtbl1_u8(first, vshr_n_u8(c, 5));
+			bytes.val[1] = vtbl1_u8(second, vand_u8(vshr_n_u8(c, 3), three));
+			bytes.val[2] = vtbl1_u8(third, vand_u8(c, seven));
+			vst3_u8(wire + j*24, bytes);
+		}
+
+		// The serializer shifts each word out MSB first, so the first wire byte goes in the top byte
+		for(j=0; j<64; j+=16) {
+			vst1q_u8(wire + j, vrev32q_u8(vld1q_u8(wire + j)));
+		}
+		vst1_u8(wire + 64, vrev32_u8(vld1_u8(wire + 64)));
+	}
+
+	if(i < count) {
+		encodeWire(table, pixels, count - i, out);
+	}
+}
+
+#endif
+
+// Whether encoder can be used in this build on this CPU
+unsigned char encoderAvailable(unsigned char encoder) {
+	switch(encoder) {
+		case ENCODER_SCALAR:
+			return true;
+		case ENCODER_NEON:
+#if defined(__aarch64__)
+			return true;
+#elif defined(__ARM_NEON)
+			return (getauxval(AT_HWCAP) & HWCAP_NEON) ? true : false;
+#else
+			return false;
+#endif
+		default:
+			return false;
+	}
+}
+
+void encodeWireRange(unsigned char encoder, const WireTable_t *table, const Color_t *pixels, unsigned int count,
+                     unsigned int first, unsigned int end, unsigned int *out) {
+	if(end > count) {
+		end = count;
+	}
+	if(first >= end) {
+		return;
+	}
+
+	if(table->symbolBits == SYMBOL_BITS_4) {
+		encodeWire(table, pixels + first, end - first, out + first * 3);
+		return;
+	}
+
+	first &= ~3;
+	end = (end + 3) & ~3;
+	if(end > count) {
+		end = count;
+	}
+#ifdef ENCODER_NEON_KERNEL
+	if(encoder == ENCODER_NEON) {
+		encodeWireNEON(table, pixels + first, end - first, out + first / 4 * 9);
+		return;
+	}
+#endif
+	encodeWire(table, pixels + first, end - first, out + first / 4 * 9);
+}
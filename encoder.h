@@ -0,0 +1,70 @@
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include "ws2812b.h"
+
+// WS2812 wire encoder
+// -------------------------------------------------------------------------------------------------
+// Every color bit becomes 3 wire bits (1 = 110, 0 = 100), so every color byte becomes 24 wire bits
+// and four color bytes fill exactly three 32-bit words. The table maps a color byte straight to its
+// 24 wire bits, already in the order the serializer shifts them out (first bit in bit 23), so the
+// encoder only ever writes whole words and nothing has to be bit-reversed afterwards.
+//
+// With 4-bit symbols (1 = 1110, 0 = 1000) a color byte is 32 wire bits, one whole word, and the
+// table entry is simply that word. The table records which of the two it holds.
+//
+// The output is a big-endian bit stream: wire bit n is bit (31 - n % 32) of word n / 32, which is
+// exactly what PWM_FIF1 expects.
+
+// Pack four 24-bit wire patterns into three words
+#define PACK4(a, b, c, d, out) \
+	(out)[0] = ((a) << 8) | ((b) >> 16); \
+	(out)[1] = ((b) << 16) | ((c) >> 8); \
+	(out)[2] = ((c) << 24) | (d)
+
+// Fill table with the plain wire pattern of every byte value
+void buildWireTable(WireTable_t *table, unsigned int symbolBits = SYMBOL_BITS_3);
+
+// Fill table with the wire pattern of r[value], g[value] and b[value] for each channel, so any
+// per-channel mapping (gamma, brightness, white balance) costs nothing extra when encoding.
+// NULL means no change for that channel.
+void buildCorrectedWireTable(WireTable_t *table, const unsigned char *r, const unsigned char *g, const unsigned char *b,
+                             unsigned int symbolBits = SYMBOL_BITS_3);
+
+// Encode count LEDs (in G, R, B order on the wire) into out[], which must hold
+// WIRE_WORDS_FOR(count, table->symbolBits) words. Any bits past the last LED in the final word
+// are zero.
+void encodeWire(const WireTable_t *table, const Color_t *pixels, unsigned int count, unsigned int *out);
+
+// The NEON kernel is built on ARM with NEON, or anywhere with -DNEON_SHIM (see neonshim.h)
+#if defined(__ARM_NEON) || defined(NEON_SHIM)
+#define ENCODER_NEON_KERNEL
+#endif
+
+#ifdef ENCODER_NEON_KERNEL
+// Same output as encodeWire() with the 3-bit table from buildWireTable(), eight LEDs at a time with
+// NEON.
+// The pattern is built into the kernel; table is only used for the last count % 8 LEDs.
+void encodeWireNEON(const WireTable_t *table, const Color_t *pixels, unsigned int count, unsigned int *out);
+#endif
+
+// Temporal dithering. Encode count 16-bit LEDs through curve and the plain table from
+// buildWireTable(). Each channel is corrected, then the 8 bits below what the LEDs can show are
+// added up in error[] (3 bytes per LED, kept between frames) and carried into the next frame, so
+// over a few frames the LEDs average out to the 16-bit value.
+void encodeWireDithered(const WireTable_t *table, const DitherCurve_t *curve, const Color16_t *pixels,
+                        unsigned char *error, unsigned int count, unsigned int *out);
+
+// Whether encoder (ENCODER_*) can be used in this build on this CPU. ENCODER_NEON needs NEON
+// enabled at compile time (e.g. -mfpu=neon) and a CPU that has it.
+unsigned char encoderAvailable(unsigned char encoder);
+
+// Re-encode only LEDs first to end-1 of a chain of count LEDs into the full wire buffer out[].
+// With 3-bit symbols the range is widened to whole groups of four LEDs, since four LEDs are the
+// smallest unit that starts and ends on a word boundary; with 4-bit symbols every LED does.
+// ENCODER_NEON is only valid with the 3-bit table from buildWireTable(); with 4-bit symbols,
+// where each byte is a single lookup anyway, the scalar encoder is used.
+void encodeWireRange(unsigned char encoder, const WireTable_t *table, const Color_t *pixels, unsigned int count,
+                     unsigned int first, unsigned int end, unsigned int *out);
+
+#endif // ENCODER_H
@@ -0,0 +1,170 @@
+#include "framering.h"
+
+static size_t frameRingSize(unsigned int numLEDs, unsigned int numSlots, unsigned int *slotStride) {
+	*slotStride = (numLEDs * sizeof(Color_t) + FRAME_RING_ALIGN - 1) / FRAME_RING_ALIGN * FRAME_RING_ALIGN;
+	return sizeof(FrameRingHeader_t) + (size_t)numSlots * *slotStride;
+}
+
+static unsigned char mapFrameRing(const char *name, int fd, size_t size, FrameRing_t *ring) {
+	ring->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(ring->map == MAP_FAILED) {
+		printf("Unable to map shared memory %s\n", name);
+		ring->map = NULL;
+		return false;
+	}
+	ring->mapSize = size;
+	ring->header = (FrameRingHeader_t *)ring->map;
+	ring->slots = (unsigned char *)ring->map + sizeof(FrameRingHeader_t);
+	strcpy(ring->name, name);
+	return true;
+}
+
+// Create the ring (replacing any left over from an earlier run) and open it to anyone, so
+// producers don't need to run as the same user. numSlots has to be a power of two.
+unsigned char createFrameRing(const char *name, unsigned int numLEDs, unsigned int numSlots, FrameRing_t *ring) {
+	unsigned int slotStride;
+	size_t size = frameRingSize(numLEDs, numSlots, &slotStride);
+	int fd;
+
+	memset(ring, 0, sizeof(FrameRing_t));
+
+	if(numLEDs == 0 || numSlots == 0 || (numSlots & (numSlots - 1)) != 0) {
+		printf("A frame ring needs at least one LED and a power of two slots\n");
+		return false;
+	}
+	if(strlen(name) >= sizeof(ring->name)) {
+		printf("Shared memory name %s is too long\n", name);
+		return false;
+	}
+
+	shm_unlink(name);
+	if((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0666)) < 0) {
+		printf("Unable to create shared memory %s\n", name);
+		return false;
+	}
+	fchmod(fd, 0666);       // Not masked by the umask
+	if(ftruncate(fd, size) != 0) {
+		printf("Unable to size shared memory %s\n", name);
+		close(fd);
+		shm_unlink(name);
+		return false;
+	}
+	if(!mapFrameRing(name, fd, size, ring)) {
+		shm_unlink(name);
+		return false;
+	}
+	ring->owner = true;
+
+	memset(ring->map, 0, size);
+	ring->header->version = FRAME_RING_VERSION;
+	ring->header->numLEDs = numLEDs;
+	ring->header->numSlots = numSlots;
+	ring->header->slotStride = slotStride;
+	ring->header->consumerAlive = 1;
+	ring->numLEDs = numLEDs;
+	ring->numSlots = numSlots;
+	ring->slotStride = slotStride;
+
+	// The magic goes in last, so a producer never sees a half set up header
+	__sync_synchronize();
+	memcpy(ring->header->magic, FRAME_RING_MAGIC, 4);
+	return true;
+}
+
+// Map a ring created by the daemon and check its header
+unsigned char openFrameRing(const char *name, FrameRing_t *ring) {
+	struct stat st;
+	int fd;
+
+	memset(ring, 0, sizeof(FrameRing_t));
+
+	if(strlen(name) >= sizeof(ring->name)) {
+		printf("Shared memory name %s is too long\n", name);
+		return false;
+	}
+	if((fd = shm_open(name, O_RDWR, 0)) < 0) {
+		printf("Unable to open shared memory %s\n", name);
+		return false;
+	}
+	if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(FrameRingHeader_t)) {
+		printf("%s is not a frame ring\n", name);
+		close(fd);
+		return false;
+	}
+	if(!mapFrameRing(name, fd, st.st_size, ring)) {
+		return false;
+	}
+
+	unsigned int slotStride;
+	FrameRingHeader_t *header = ring->header;
+	unsigned int numLEDs = header->numLEDs;
+	unsigned int numSlots = header->numSlots;
+	if(memcmp(header->magic, FRAME_RING_MAGIC, 4) != 0 || header->version != FRAME_RING_VERSION) {
+		printf("%s is not a version %d frame ring\n", name, FRAME_RING_VERSION);
+		closeFrameRing(ring);
+		return false;
+	}
+	if(numLEDs == 0 || numSlots == 0 || (numSlots & (numSlots - 1)) != 0 ||
+	   frameRingSize(numLEDs, numSlots, &slotStride) > ring->mapSize ||
+	   header->slotStride != slotStride) {
+		printf("%s is corrupt\n", name);
+		closeFrameRing(ring);
+		return false;
+	}
+	ring->numLEDs = numLEDs;
+	ring->numSlots = numSlots;
+	ring->slotStride = slotStride;
+	return true;
+}
+
+void closeFrameRing(FrameRing_t *ring) {
+	if(ring->map != NULL) {
+		if(ring->owner) {
+			__atomic_store_n(&ring->header->consumerAlive, 0, __ATOMIC_RELEASE);
+			shm_unlink(ring->name);
+		}
+		munmap(ring->map, ring->mapSize);
+	}
+	memset(ring, 0, sizeof(FrameRing_t));
+}
+
+// The slot to render the next frame into, or NULL if the daemon hasn't caught up yet (try again
+// later). Calling it again before publishFrame() returns the same slot.
+Color_t *beginFrame(FrameRing_t *ring) {
+	FrameRingHeader_t *header = ring->header;
+	uint32_t head = header->head;       // Only we write it
+	uint32_t tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+
+	if(head - tail >= ring->numSlots) {
+		return NULL;
+	}
+	return (Color_t *)(ring->slots + (size_t)(head & (ring->numSlots - 1)) * ring->slotStride);
+}
+
+// Hand the frame from beginFrame() to the daemon
+void publishFrame(FrameRing_t *ring) {
+	__atomic_store_n(&ring->header->head, ring->header->head + 1, __ATOMIC_RELEASE);
+}
+
+// Is the daemon that created the ring still running?
+unsigned char frameRingAlive(const FrameRing_t *ring) {
+	return __atomic_load_n(&ring->header->consumerAlive, __ATOMIC_ACQUIRE) ? true : false;
+}
+
+// The oldest published frame, or NULL if there's none. It stays valid until releaseFrame().
+const Color_t *nextFrame(FrameRing_t *ring) {
+	FrameRingHeader_t *header = ring->header;
+	uint32_t tail = header->tail;       // Only we write it
+	uint32_t head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+
+	if(head == tail) {
+		return NULL;
+	}
+	return (const Color_t *)(ring->slots + (size_t)(tail & (ring->numSlots - 1)) * ring->slotStride);
+}
+
+// Give the frame from nextFrame() back to the producer
+void releaseFrame(FrameRing_t *ring) {
+	__atomic_store_n(&ring->header->tail, ring->header->tail + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,82 @@
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <stdint.h>
+#include "ws2812b.h"
+
+// Shared-memory frame ring
+// -------------------------------------------------------------------------------------------------
+// Lets processes that can't touch the hardware hand frames to one that can (see neo-daemon). The
+// daemon creates a POSIX shared memory object holding numSlots frames of numLEDs Color_t each,
+// and a producer maps the same object, renders straight into the next free slot and publishes it.
+// It's a single-producer, single-consumer ring: head counts frames published and is only written
+// by the producer, tail counts frames consumed and is only written by the daemon. Both only ever
+// go up, and a slot is free while head - tail < numSlots, so neither side needs a lock or a
+// syscall per frame.
+//
+// Only one producer may be attached at a time. It can exit and be restarted at will: head lives
+// in the shared memory, and a frame it started but never published is simply overwritten. If the
+// daemon goes away it clears consumerAlive, and a producer should reopen the ring.
+//
+//   offset  size  field
+//        0     4  magic "W2FR"
+//        4     4  version (FRAME_RING_VERSION)
+//        8     4  numLEDs
+//       12     4  numSlots (a power of two)
+//       16     4  slotStride, in bytes
+//       20     4  consumerAlive
+//       64     4  head
+//      128     4  tail
+//      192        slots
+
+#define FRAME_RING_MAGIC    "W2FR"
+#define FRAME_RING_VERSION  1
+
+// Slots are cache line aligned, and head and tail get a cache line each so the two sides don't
+// keep stealing one line from each other
+#define FRAME_RING_ALIGN    64
+
+typedef struct FrameRingHeader_t {
+	char magic[4];
+	uint32_t version;
+	uint32_t numLEDs;
+	uint32_t numSlots;
+	uint32_t slotStride;
+	uint32_t consumerAlive;
+	uint32_t reserved[10];
+	uint32_t head;
+	uint32_t pad1[15];
+	uint32_t tail;
+	uint32_t pad2[15];
+} FrameRingHeader_t;
+
+// A frame ring mapped into this process
+typedef struct FrameRing_t {
+	FrameRingHeader_t *header;
+	unsigned char *slots;
+	void *map;
+	size_t mapSize;
+	char name[64];
+	unsigned char owner;            // We created it, so closing it removes it
+
+	// The layout, as checked when the ring was created or opened. The header is writable by
+	// anyone, so slots are only ever found with these.
+	unsigned int numLEDs;
+	unsigned int numSlots;
+	unsigned int slotStride;
+} FrameRing_t;
+
+// Daemon side
+unsigned char createFrameRing(const char *name, unsigned int numLEDs, unsigned int numSlots, FrameRing_t *ring);
+const Color_t *nextFrame(FrameRing_t *ring);
+void releaseFrame(FrameRing_t *ring);
+
+// Producer side
+unsigned char openFrameRing(const char *name, FrameRing_t *ring);
+Color_t *beginFrame(FrameRing_t *ring);
+void publishFrame(FrameRing_t *ring);
+unsigned char frameRingAlive(const FrameRing_t *ring);
+
+void closeFrameRing(FrameRing_t *ring);
+
+#endif // FRAMERING_H
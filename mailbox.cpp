@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "mailbox.h"
+
+#define MAJOR_NUM 100
+#define IOCTL_MBOX_PROPERTY _IOWR(MAJOR_NUM, 0, char *)
+#define DEVICE_FILE_NAME "/dev/vcio"
+
+// Send a property message to the firmware. buf[] is updated in place with the response.
+static int mbox_property(int file_desc, void *buf) {
+	int ret = ioctl(file_desc, IOCTL_MBOX_PROPERTY, buf);
+
+	if(ret < 0) {
+		printf("ioctl_set_msg failed: %d\n", ret);
+	}
+	return ret;
+}
+
+// Open the mailbox device. Returns a file descriptor, or -1 if the device isn't there.
+int mbox_open() {
+	int file_desc = open(DEVICE_FILE_NAME, 0);
+
+	if(file_desc < 0) {
+		printf("Can't open device file: %s\n", DEVICE_FILE_NAME);
+	}
+	return file_desc;
+}
+
+void mbox_close(int file_desc) {
+	close(file_desc);
+}
+
+// Allocate a block of GPU memory. Returns a handle, or 0 on failure.
+unsigned int mem_alloc(int file_desc, unsigned int size, unsigned int align, unsigned int flags) {
+	int i = 0;
+	unsigned int p[32];
+
+	p[i++] = 0;                     // Size of the message (filled in below)
+	p[i++] = 0x00000000;            // Process request
+	p[i++] = 0x3000c;               // Tag: allocate memory
+	p[i++] = 12;                    // Size of the buffer
+	p[i++] = 12;                    // Size of the data
+	p[i++] = size;                  // Number of bytes
+	p[i++] = align;                 // Alignment
+	p[i++] = flags;                 // MEM_FLAG_*
+	p[i++] = 0x00000000;            // End tag
+	p[0] = i * sizeof(*p);
+
+	if(mbox_property(file_desc, p) < 0) {
+		return 0;
+	}
+	return p[5];
+}
+
+unsigned int mem_free(int file_desc, unsigned int handle) {
+	int i = 0;
+	unsigned int p[32];
+
+	p[i++] = 0;
+	p[i++] = 0x00000000;
+	p[i++] = 0x3000f;               // Tag: release memory
+	p[i++] = 4;
+	p[i++] = 4;
+	p[i++] = handle;
+	p[i++] = 0x00000000;
+	p[0] = i * sizeof(*p);
+
+	if(mbox_property(file_desc, p) < 0) {
+		return 0;
+	}
+	return p[5];
+}
+
+// Lock a block in place. Returns its bus address, or 0 on failure.
+unsigned int mem_lock(int file_desc, unsigned int handle) {
+	int i = 0;
+	unsigned int p[32];
+
+	p[i++] = 0;
+	p[i++] = 0x00000000;
+	p[i++] = 0x3000d;               // Tag: lock memory
+	p[i++] = 4;
+	p[i++] = 4;
+	p[i++] = handle;
+	p[i++] = 0x00000000;
+	p[0] = i * sizeof(*p);
+
+	if(mbox_property(file_desc, p) < 0) {
+		return 0;
+	}
+	return p[5];
+}
+
+unsigned int mem_unlock(int file_desc, unsigned int handle) {
+	int i = 0;
+	unsigned int p[32];
+
+	p[i++] = 0;
+	p[i++] = 0x00000000;
+	p[i++] = 0x3000e;               // Tag: unlock memory
+	p[i++] = 4;
+	p[i++] = 4;
+	p[i++] = handle;
+	p[i++] = 0x00000000;
+	p[0] = i * sizeof(*p);
+
+	if(mbox_property(file_desc, p) < 0) {
+		return 0;
+	}
+	return p[5];
+}
+
+// Map a physical address range into user space. Returns NULL on failure.
+void *mapmem(unsigned int base, unsigned int size) {
+	int mem_fd;
+	unsigned int offset = base % 4096;
+	void *mem;
+
+	base = base - offset;
+	size = size + offset;
+
+	if((mem_fd = open("/dev/mem", O_RDWR|O_SYNC)) < 0) {
+		printf("can't open /dev/mem\n");
+		return NULL;
+	}
+
+	mem = mmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED, mem_fd, base);
+	close(mem_fd);
+
+	if(mem == MAP_FAILED) {
+		printf("mmap error %p\n", mem);
+		return NULL;
+	}
+	return (char *)mem + offset;
+}
+
+void unmapmem(void *addr, unsigned int size) {
+	unsigned long offset = (unsigned long)addr % 4096;
+
+	munmap((char *)addr - offset, size + offset);
+}
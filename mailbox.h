@@ -0,0 +1,34 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+// VideoCore mailbox interface (/dev/vcio)
+// -------------------------------------------------------------------------------------------------
+// The DMA controller works with bus addresses, so anything it reads has to live in physically
+// contiguous memory that we know the bus address of. User space can't get that from malloc(), but
+// the GPU firmware will hand out such blocks through the mailbox property interface. The block is
+// then mapped into our address space through /dev/mem, just like the peripheral registers.
+
+// Allocation flags for mem_alloc()
+#define MEM_FLAG_DISCARDABLE    (1 << 0)        // Can be resized to 0 at any time. Use for cached data
+#define MEM_FLAG_NORMAL         (0 << 2)        // Normal allocating alias. Don't use from ARM
+#define MEM_FLAG_DIRECT         (1 << 2)        // 0xC alias uncached
+#define MEM_FLAG_COHERENT       (2 << 2)        // 0x8 alias. Non-allocating in L2 but coherent
+#define MEM_FLAG_ZERO           (1 << 4)        // Initialise buffer to all zeros
+#define MEM_FLAG_NO_INIT        (1 << 5)        // Don't initialise (default is initialise to all ones)
+#define MEM_FLAG_HINT_PERMALOCK (1 << 6)        // Likely to be locked for long periods of time
+
+// Strip the VideoCore alias bits off a bus address to get the ARM physical address
+#define BUS_TO_PHYS(x) ((x) & ~0xC0000000)
+
+int mbox_open();
+void mbox_close(int file_desc);
+
+unsigned int mem_alloc(int file_desc, unsigned int size, unsigned int align, unsigned int flags);
+unsigned int mem_free(int file_desc, unsigned int handle);
+unsigned int mem_lock(int file_desc, unsigned int handle);
+unsigned int mem_unlock(int file_desc, unsigned int handle);
+
+void *mapmem(unsigned int base, unsigned int size);
+void unmapmem(void *addr, unsigned int size);
+
+#endif // MAILBOX_H
@@ -0,0 +1,342 @@
+#include "ws2812b.h"
+#include "encoder.h"
+#include "simulator.h"
+
+// Benchmarks for loading the LED buffer, encoding it into wire format and show(), on any Linux
+// machine. show() runs its whole path against SimulatedBackend in DMA mode, with the wire recording
+// turned off so long runs don't pile up memory. Results go to stdout as CSV, one line per benchmark
+// and strip length:
+//
+//   benchmark,leds,iterations,ns_per_frame,pixels_per_sec
+//
+// so two runs can be diffed or compared by a script. Before timing anything every encoder is
+// checked against the original bit-at-a-time encoder; a mismatch is reported on stderr and the
+// exit status is 1.
+//
+//   neo-bench [budgetMs per benchmark] [strip lengths...]
+
+#define DEFAULT_BUDGET_MS       100
+#define MIN_ITERATIONS          3
+
+static const unsigned int defaultLengths[] = { 1, 10, 100, 1000, 10000 };
+
+// Everything a benchmark needs, for one strip length
+typedef struct Bench_t {
+    unsigned int numLEDs;
+    Color_t *pixels;            // The frame to load or encode
+    Color16_t *pixels16;
+    unsigned char *error;       // Dithering error, 3 bytes per LED
+    unsigned int *wire;         // Room for 4-bit symbols
+    WireTable_t table3;
+    WireTable_t table4;
+    DitherCurve_t curve;
+    ws2812b *strip;
+    unsigned int frame;         // Counts iterations, so consecutive frames differ
+} Bench_t;
+
+typedef void (*BenchFunction_t)(Bench_t *b);
+
+// The encoder show() started out with: every wire bit set one at a time with setPWMBit(), in
+// G, R, B order, then each word bit-reversed with reverseWord() on its way to the FIFO. Without
+// the reversal its output is what encodeWire() has to produce.
+static void setPWMBit(unsigned int *wire, unsigned int bitPos, unsigned char bit){
+    unsigned int wordOffset = bitPos / 32;
+    unsigned int bitIdx = 31 - (bitPos - wordOffset * 32);
+    if(bit){
+        wire[wordOffset] |= (1 << bitIdx);
+    } else {
+        wire[wordOffset] &= ~(1 << bitIdx);
+    }
+}
+
+static unsigned int reverseWord(unsigned int word){
+    unsigned int output = 0;
+    int i;
+    for(i=0; i<32; i++){
+        output |= word & (1 << i) ? 1 : 0;
+        if(i < 31){
+            output <<= 1;
+        }
+    }
+    return output;
+}
+
+static void encodeBitwise(const Color_t *pixels, unsigned int count, unsigned int symbolBits, unsigned int *wire){
+    unsigned int i, wireBit = 0;
+    int j;
+
+    memset(wire, 0, WIRE_WORDS_FOR(count, symbolBits) * sizeof(unsigned int));
+    for(i=0; i<count; i++){
+        unsigned int colorBits = ((unsigned int)pixels[i].r << 8) | ((unsigned int)pixels[i].g << 16) | pixels[i].b;
+        for(j=23; j>=0; j--){
+            unsigned char colorBit = (colorBits & (1 << j)) ? 1 : 0;
+            setPWMBit(wire, wireBit++, 1);
+            setPWMBit(wire, wireBit++, colorBit);
+            if(symbolBits == SYMBOL_BITS_4){
+                setPWMBit(wire, wireBit++, colorBit);
+            }
+            setPWMBit(wire, wireBit++, 0);
+        }
+    }
+}
+
+// Whether the NEON kernel can be checked: on a CPU with NEON, or anywhere when it's built through
+// neonshim.h with -DNEON_SHIM (it's never timed then, only checked)
+#ifdef ENCODER_NEON_KERNEL
+static unsigned char neonCheckable(){
+#ifdef NEON_SHIM
+    return true;
+#else
+    return encoderAvailable(ENCODER_NEON);
+#endif
+}
+#endif
+
+// Compare every encoder with encodeBitwise() over a few lengths and ranges. Returns the number of
+// mismatches.
+static unsigned int checkEncoders(Bench_t *b){
+    static const unsigned int lengths[] = { 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 37, 100, 1001 };
+    unsigned int words = WIRE_WORDS_FOR(1001, SYMBOL_BITS_4);
+    unsigned int *expect = (unsigned int *)malloc(words * sizeof(unsigned int));
+    unsigned int *got = (unsigned int *)malloc(words * sizeof(unsigned int));
+    unsigned int l, bits, first, end, failures = 0;
+
+    for(l=0; l<sizeof(lengths) / sizeof(lengths[0]); l++){
+        unsigned int n = lengths[l];
+        for(bits=SYMBOL_BITS_3; bits<=SYMBOL_BITS_4; bits++){
+            const WireTable_t *table = bits == SYMBOL_BITS_3 ? &b->table3 : &b->table4;
+            unsigned int size = WIRE_WORDS_FOR(n, bits) * sizeof(unsigned int);
+            encodeBitwise(b->pixels, n, bits, expect);
+
+            // Garbage first, to catch bits past the last LED that aren't cleared
+            memset(got, 0xA5, size);
+            encodeWire(table, b->pixels, n, got);
+            if(memcmp(got, expect, size) != 0){
+                fprintf(stderr, "encodeWire, %d LEDs, %d-bit symbols: wrong output\n", n, bits);
+                failures++;
+            }
+
+            // Re-encoding a range into a stale buffer has to give the same buffer
+            for(first=0; first<n; first+=(n + 2) / 3){
+                end = first + (n - first + 1) / 2;
+                if(end <= first){
+                    end = first + 1;
+                }
+                memcpy(got, expect, size);
+                encodeWireRange(ENCODER_SCALAR, table, b->pixels, n, first, end, got);
+                if(memcmp(got, expect, size) != 0){
+                    fprintf(stderr, "encodeWireRange, %d LEDs, %d-%d, %d-bit symbols: wrong output\n", n, first, end, bits);
+                    failures++;
+                }
+#ifdef ENCODER_NEON_KERNEL
+                if(neonCheckable()){
+                    memcpy(got, expect, size);
+                    encodeWireRange(ENCODER_NEON, table, b->pixels, n, first, end, got);
+                    if(memcmp(got, expect, size) != 0){
+                        fprintf(stderr, "encodeWireRange (NEON), %d LEDs, %d-%d, %d-bit symbols: wrong output\n", n, first, end, bits);
+                        failures++;
+                    }
+                }
+#endif
+            }
+        }
+#ifdef ENCODER_NEON_KERNEL
+        if(neonCheckable()){
+            unsigned int size = WIRE_WORDS_FOR(n, SYMBOL_BITS_3) * sizeof(unsigned int);
+            encodeBitwise(b->pixels, n, SYMBOL_BITS_3, expect);
+            memset(got, 0xA5, size);
+            encodeWireNEON(&b->table3, b->pixels, n, got);
+            if(memcmp(got, expect, size) != 0){
+                fprintf(stderr, "encodeWireNEON, %d LEDs: wrong output\n", n);
+                failures++;
+            }
+        }
+#endif
+    }
+
+    free(got);
+    free(expect);
+    return failures;
+}
+
+static void benchSetPixelColor(Bench_t *b){
+    unsigned int i;
+    for(i=0; i<b->numLEDs; i++){
+        b->strip->setPixelColor(i, b->pixels[i].r, b->pixels[i].g, b->frame);
+    }
+}
+
+static void benchSetPixels(Bench_t *b){
+    b->strip->setPixels(0, b->numLEDs, b->pixels);
+}
+
+static void benchFill(Bench_t *b){
+    b->strip->fill(0, b->numLEDs, b->frame, 0, 0);
+}
+
+static void benchEncodeBitwise(Bench_t *b){
+    unsigned int i, words = WIRE_WORDS(b->numLEDs);
+    encodeBitwise(b->pixels, b->numLEDs, SYMBOL_BITS_3, b->wire);
+    for(i=0; i<words; i++){
+        b->wire[i] = reverseWord(b->wire[i]);
+    }
+}
+
+static void benchEncodeScalar(Bench_t *b){
+    encodeWire(&b->table3, b->pixels, b->numLEDs, b->wire);
+}
+
+static void benchEncodeScalar4(Bench_t *b){
+    encodeWire(&b->table4, b->pixels, b->numLEDs, b->wire);
+}
+
+#ifdef ENCODER_NEON_KERNEL
+static void benchEncodeNEON(Bench_t *b){
+    encodeWireNEON(&b->table3, b->pixels, b->numLEDs, b->wire);
+}
+#endif
+
+static void benchEncodeDithered(Bench_t *b){
+    encodeWireDithered(&b->table3, &b->curve, b->pixels16, b->error, b->numLEDs, b->wire);
+}
+
+// show() with every LED changed, so the whole chain is encoded
+static void benchShowAll(Bench_t *b){
+    b->pixels[0].b = b->frame;
+    b->strip->setPixels(0, b->numLEDs, b->pixels);
+    b->strip->show();
+}
+
+// show() with one LED changed, so only its group is encoded
+static void benchShowOne(Bench_t *b){
+    b->strip->setPixelColor(b->frame % b->numLEDs, b->frame, 0, 0);
+    b->strip->show();
+}
+
+static void printResult(const char *name, unsigned int numLEDs, unsigned long iterations, double nsPerFrame){
+    printf("%s,%u,%lu,%.1f,%.0f\n", name, numLEDs, iterations, nsPerFrame,
+           nsPerFrame > 0 ? numLEDs * 1e9 / nsPerFrame : 0);
+    fflush(stdout);
+}
+
+// Run function over and over for budgetNs (and at least MIN_ITERATIONS times), then print the mean
+static void runBench(const char *name, BenchFunction_t function, Bench_t *b, unsigned long long budgetNs){
+    unsigned long iterations = 0;
+    unsigned long long start = monotonicNs(), elapsed;
+
+    do {
+        b->frame++;
+        function(b);
+        iterations++;
+        elapsed = monotonicNs() - start;
+    } while(elapsed < budgetNs || iterations < MIN_ITERATIONS);
+
+    printResult(name, b->numLEDs, iterations, (double)elapsed / iterations);
+}
+
+// Time show() and also print the part of it the CPU spends encoding and setting up the DMA, as
+// opposed to waiting for the previous frame to go out on the wire
+static void runShowBench(const char *name, BenchFunction_t function, Bench_t *b, unsigned long long budgetNs){
+    OutputStats_t stats;
+    char cpuName[64];
+
+    b->strip->show();
+    b->strip->resetStats();
+    runBench(name, function, b, budgetNs);
+    b->strip->getStats(&stats);
+    if(stats.frames){
+        snprintf(cpuName, sizeof(cpuName), "%s_cpu", name);
+        printResult(cpuName, b->numLEDs, stats.frames, (double)(stats.encodeNs + stats.fillNs) / stats.frames);
+    }
+}
+
+int main(int argc, char **argv){
+
+    unsigned int budgetMs = argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_BUDGET_MS;
+    unsigned long long budgetNs = budgetMs * 1000000ULL;
+    unsigned int numLengths = argc > 2 ? argc - 2 : sizeof(defaultLengths) / sizeof(defaultLengths[0]);
+    unsigned int *lengths = (unsigned int *)malloc(numLengths * sizeof(unsigned int));
+    unsigned int i, l, maxLEDs = 1001;
+    unsigned int failures;
+
+    for(l=0; l<numLengths; l++){
+        lengths[l] = argc > 2 ? strtoul(argv[l + 2], NULL, 0) : defaultLengths[l];
+        if(lengths[l] == 0){
+            printf("Usage: %s [budgetMs] [strip lengths, at least 1 LED each...]\n", argv[0]);
+            return 1;
+        }
+        if(lengths[l] > maxLEDs){
+            maxLEDs = lengths[l];
+        }
+    }
+
+    // One set of buffers big enough for the longest strip, filled with a repeatable pattern
+    Bench_t b;
+    memset(&b, 0, sizeof(b));
+    b.pixels = (Color_t *)malloc(maxLEDs * sizeof(Color_t));
+    b.pixels16 = (Color16_t *)malloc(maxLEDs * sizeof(Color16_t));
+    b.error = (unsigned char *)calloc(maxLEDs, 3);
+    b.wire = (unsigned int *)malloc(WIRE_WORDS_FOR(maxLEDs, SYMBOL_BITS_4) * sizeof(unsigned int));
+    if(b.pixels == NULL || b.pixels16 == NULL || b.error == NULL || b.wire == NULL){
+        printf("allocation error \n");
+        return 1;
+    }
+    srand(1);
+    for(i=0; i<maxLEDs; i++){
+        b.pixels[i].r = rand();
+        b.pixels[i].g = rand();
+        b.pixels[i].b = rand();
+        b.pixels16[i].r = rand();
+        b.pixels16[i].g = rand();
+        b.pixels16[i].b = rand();
+    }
+    buildWireTable(&b.table3, SYMBOL_BITS_3);
+    buildWireTable(&b.table4, SYMBOL_BITS_4);
+    for(i=0; i<=256; i++){
+        b.curve.gamma[i] = i * 65535 / 256;
+    }
+    b.curve.scale[0] = b.curve.scale[1] = b.curve.scale[2] = 65535;
+
+    failures = checkEncoders(&b);
+    if(failures){
+        fprintf(stderr, "%d encoder mismatches\n", failures);
+    }
+
+    printf("benchmark,leds,iterations,ns_per_frame,pixels_per_sec\n");
+    for(l=0; l<numLengths; l++){
+        SimulatedBackend backend;
+        backend.setRecording(false);
+        b.numLEDs = lengths[l];
+        b.strip = new ws2812b(b.numLEDs);
+        b.strip->setBackend(&backend);
+        b.strip->setTransmitMode(TX_MODE_DMA);
+        if(!b.strip->initHardware()){
+            return 1;
+        }
+
+        runBench("set_pixel_color", benchSetPixelColor, &b, budgetNs);
+        runBench("set_pixels", benchSetPixels, &b, budgetNs);
+        runBench("fill", benchFill, &b, budgetNs);
+        runBench("encode_bitwise", benchEncodeBitwise, &b, budgetNs);
+        runBench("encode_scalar", benchEncodeScalar, &b, budgetNs);
+        runBench("encode_scalar_4bit", benchEncodeScalar4, &b, budgetNs);
+#ifdef ENCODER_NEON_KERNEL
+        if(encoderAvailable(ENCODER_NEON)){
+            runBench("encode_neon", benchEncodeNEON, &b, budgetNs);
+        }
+#endif
+        runBench("encode_dithered", benchEncodeDithered, &b, budgetNs);
+        runShowBench("show_all", benchShowAll, &b, budgetNs);
+        runShowBench("show_one", benchShowOne, &b, budgetNs);
+
+        delete b.strip;
+    }
+
+    free(b.wire);
+    free(b.error);
+    free(b.pixels16);
+    free(b.pixels);
+    free(lengths);
+
+    return failures ? 1 : 0;
+}
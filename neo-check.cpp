@@ -0,0 +1,493 @@
+#include "ws2812b.h"
+#include "simulator.h"
+
+// Check the driver end to end without a Pi: show() and showAsync(), through the FIFO and through
+// DMA, on one strip and on two, all against SimulatedBackend. What left the modeled serializer is
+// decoded back into pixels and compared with what was set, and every frame has to be free of gaps,
+// malformed symbols and stray bits. Prints one line per case and exits with status 1 if any fails.
+//
+// The "few LEDs" cases set every LED in the first frame and then only a handful per frame, so only
+// the changed part is re-encoded. Each decoded frame is still compared LED by LED with the whole
+// frame expected. After showAsync() the LED buffer is the one two frames back (the buffers are
+// swapped, not copied), so that's what those cases expect to see for the LEDs they don't set.
+//
+// The corrected cases set gamma (different per strip when there are two), brightness and a white
+// balance that scales each color differently, and expect every LED to arrive corrected, each
+// color through its own scale.
+//
+// The dithered cases set 16-bit colors with a part below 8 bits and show the same frame
+// DITHER_FRAMES times. Averaged over those frames, each LED has to come out within 1 LSB of its
+// target, and within DITHER_TOLERANCE of it, which only holds if the part each frame drops is
+// carried into the next: dropping it every frame would leave the LED up to a whole LSB short.
+//
+// The captured cases capture the frames (captureFrame()) instead of showing them, which mustn't
+// send anything, then replay them CAPTURE_LOOPS times with playFrames(). Every replayed frame is
+// compared with the pixels it was captured from. The replay has to take at least half as long as
+// its intervals add up to, which frames sent back to back come nowhere near. Frames are paced
+// against absolute deadlines, so a frame that goes out late is followed by one that goes out
+// early; only the whole run is steady, and a late first frame shortens it.
+//
+// The fault cases have the simulator break one frame on purpose (injectFault()) with retries on.
+// The driver has to count the error, send the frame again, and the copy has to arrive intact.
+//
+// In FIFO mode the CPU feeds the serializer itself, so on a busy machine a frame can underrun for
+// real. If the driver saw that too (getStats() counts the gap), the case is run again, up to
+// MAX_ATTEMPTS times; an underrun the driver didn't see is a failure straight away. Busy spells
+// tend to last, so each attempt waits RETRY_PAUSE_MS longer than the one before.
+
+#define NUM_LEDS        40
+#define NUM_FRAMES      4
+#define MAX_ATTEMPTS    5
+#define RETRY_PAUSE_MS  200
+#define FAULT_FRAME     1       // Frame the fault cases break, counting from 0
+#define FAULT_WORD      20      // Word period of it the fault hits: well inside the frame
+
+// Correction for the corrected cases
+#define CORRECT_GAMMA   2.2f    // The second strip, if any, gets none
+#define CORRECT_BRIGHTNESS 200
+static const unsigned char whiteBalance[3] = { 255, 160, 90 };
+
+// Dithered cases
+#define DITHER_FRAMES   16
+#define DITHER_TOLERANCE (2.0 / DITHER_FRAMES)   // LSBs
+
+// Captured cases
+#define CAPTURE_LOOPS   2
+#define CAPTURE_INTERVAL_US 5000
+
+typedef struct Case_t {
+    const char *name;
+    unsigned char mode;         // TX_MODE_*
+    unsigned int strips;
+    unsigned char async;        // showAsync() instead of show()
+    unsigned int dataRate;
+    unsigned int symbolBits;
+    unsigned int fault;         // SIM_FAULT_* to force in FAULT_FRAME, with retries on; 0: none
+    unsigned char few;          // Only change the LEDs in changes[] after the first frame
+    unsigned char corrected;    // Gamma, brightness and white balance on
+    unsigned char dithered;     // Show one 16-bit frame DITHER_FRAMES times instead
+    unsigned char captured;     // Capture the frames and replay them instead of showing them
+} Case_t;
+
+// LEDs the "few LEDs" cases change in each frame after the first: runs across a 4-LED boundary
+// (where encodeWireRange() widens to whole groups), single LEDs at both ends and in the middle of
+// a group, and the seam between the two strips. NUM_LEDS ends a list.
+static const unsigned int changes[NUM_FRAMES][5] = {
+    { NUM_LEDS },
+    { 3, 4, 5, NUM_LEDS },
+    { 0, 19, 20, 39, NUM_LEDS },
+    { 7, 8, 22, NUM_LEDS },
+};
+
+static const Case_t cases[] = {
+    { "fifo show",              TX_MODE_FIFO, 1, false, DATA_RATE_WS2812B, SYMBOL_BITS_3 },
+    { "fifo showAsync",         TX_MODE_FIFO, 1, true,  DATA_RATE_WS2812B, SYMBOL_BITS_3 },
+    { "fifo show 2 strips",     TX_MODE_FIFO, 2, false, DATA_RATE_WS2812B, SYMBOL_BITS_3 },
+    { "fifo showAsync 2 strips", TX_MODE_FIFO, 2, true, DATA_RATE_WS2812B, SYMBOL_BITS_3 },
+    { "dma show",               TX_MODE_DMA,  1, false, DATA_RATE_WS2812B, SYMBOL_BITS_3 },
+    { "dma showAsync",          TX_MODE_DMA,  1, true,  DATA_RATE_WS2812B, SYMBOL_BITS_3 },
+    { "dma show 2 strips",      TX_MODE_DMA,  2, false, DATA_RATE_WS2812B, SYMBOL_BITS_3 },
+    { "dma showAsync 2 strips", TX_MODE_DMA,  2, true,  DATA_RATE_WS2812B, SYMBOL_BITS_3 },
+    { "dma show ws2811 4-bit",  TX_MODE_DMA,  2, false, DATA_RATE_WS2811,  SYMBOL_BITS_4 },
+    { "fifo show resent after gap", TX_MODE_FIFO, 1, false, DATA_RATE_WS2812B, SYMBOL_BITS_3, SIM_FAULT_GAP },
+    { "dma show resent after gap", TX_MODE_DMA, 2, false, DATA_RATE_WS2812B, SYMBOL_BITS_3, SIM_FAULT_GAP },
+    { "dma showAsync resent after read error", TX_MODE_DMA, 1, true, DATA_RATE_WS2812B, SYMBOL_BITS_3, SIM_FAULT_READ },
+    { "fifo show few LEDs",     TX_MODE_FIFO, 1, false, DATA_RATE_WS2812B, SYMBOL_BITS_3, 0, true },
+    { "fifo showAsync few LEDs", TX_MODE_FIFO, 2, true, DATA_RATE_WS2812B, SYMBOL_BITS_3, 0, true },
+    { "dma show few LEDs 2 strips", TX_MODE_DMA, 2, false, DATA_RATE_WS2812B, SYMBOL_BITS_3, 0, true },
+    { "dma showAsync few LEDs", TX_MODE_DMA, 1, true,  DATA_RATE_WS2812B, SYMBOL_BITS_3, 0, true },
+    { "fifo showAsync corrected", TX_MODE_FIFO, 1, true, DATA_RATE_WS2812B, SYMBOL_BITS_3, 0, false, true },
+    { "dma show corrected 2 strips", TX_MODE_DMA, 2, false, DATA_RATE_WS2812B, SYMBOL_BITS_3, 0, false, true },
+    { "dma show corrected few LEDs 4-bit", TX_MODE_DMA, 1, false, DATA_RATE_WS2812B, SYMBOL_BITS_4, 0, true, true },
+    { "dma show dithered",      TX_MODE_DMA,  1, false, DATA_RATE_WS2812B, SYMBOL_BITS_3, 0, false, false, true },
+    { "dma showAsync dithered corrected", TX_MODE_DMA, 1, true, DATA_RATE_WS2812B, SYMBOL_BITS_3, 0, false, true, true },
+    { "dma show dithered corrected 2 strips 4-bit", TX_MODE_DMA, 2, false, DATA_RATE_WS2812B, SYMBOL_BITS_4, 0, false, true, true },
+    { "fifo captured",          TX_MODE_FIFO, 1, false, DATA_RATE_WS2812B, SYMBOL_BITS_3, 0, false, false, false, true },
+    { "dma captured few LEDs 2 strips", TX_MODE_DMA, 2, false, DATA_RATE_WS2812B, SYMBOL_BITS_3, 0, true, false, false, true },
+    { "dma captured corrected 4-bit", TX_MODE_DMA, 1, false, DATA_RATE_WS2812B, SYMBOL_BITS_4, 0, false, true, false, true },
+};
+
+// What each frame should show, worked out by expectFrames()
+static Color_t want[NUM_FRAMES][NUM_LEDS];
+
+// What LED i is set to in frame f
+static Color_t pattern(unsigned int f, unsigned int i){
+    Color_t color;
+    color.r = i * 6 + f;
+    color.g = 255 - i * 3;
+    color.b = (i * 37) ^ (f * 85);
+    return color;
+}
+
+// What LED i is set to in the dithered cases. None of it is near full scale, where dithering
+// can't go any higher.
+static Color16_t pattern16(unsigned int i){
+    Color16_t color;
+    color.r = i * 1500 + 77;
+    color.g = 62000 - i * 1400;
+    color.b = (i * 7919) % 60000 + 128;
+    return color;
+}
+
+// Whether LED i is set in frame f
+static unsigned char isSet(const Case_t *c, unsigned int f, unsigned int i){
+    unsigned int j;
+    if(!c->few || f == 0){
+        return true;
+    }
+    for(j=0; changes[f][j] != NUM_LEDS; j++){
+        if(changes[f][j] == i){
+            return true;
+        }
+    }
+    return false;
+}
+
+// One color byte through gamma, brightness and white balance for color c (0-2: R, G, B), worked
+// out the way ws2812b::updateWireTables() documents it
+static unsigned char correct(unsigned char value, float gamma, unsigned int c){
+    unsigned int curve = (unsigned char)(pow(value / 255.0, gamma) * 255.0 + 0.5);
+    return (curve * CORRECT_BRIGHTNESS * whiteBalance[c] + 65025 / 2) / 65025;
+}
+
+// The 8-bit level, with its fraction, that a 16-bit color value should average out to once it's
+// through the curve and color scale of a DitherCurve_t (see ws2812b::updateWireTables())
+static double ditherTarget(const Case_t *c, unsigned short value, float gamma, unsigned int color){
+    unsigned int brightness = c->corrected ? CORRECT_BRIGHTNESS : 255;
+    unsigned int balance = c->corrected ? whiteBalance[color] : 255;
+    unsigned int scale = brightness * balance * 65535U / 65025;
+    return pow(value / 65536.0, gamma) * 65535.0 * scale / 65536.0 / 256.0;
+}
+
+// Fill in want[]: what the LEDs show in each frame. That's what's in the LED buffer, corrected if
+// the case corrects. showAsync() alternates between two buffers, both black to start with.
+static void expectFrames(const Case_t *c){
+    static Color_t buffers[2][NUM_LEDS];
+    unsigned int stripLength = (NUM_LEDS + c->strips - 1) / c->strips;
+    unsigned int f, i;
+
+    memset(buffers, 0, sizeof(buffers));
+    for(f=0; f<NUM_FRAMES; f++){
+        Color_t *buffer = buffers[c->async ? f % 2 : 0];
+        for(i=0; i<NUM_LEDS; i++){
+            if(isSet(c, f, i)){
+                buffer[i] = pattern(f, i);
+            }
+        }
+        memcpy(want[f], buffer, sizeof(want[f]));
+        for(i=0; c->corrected && i<NUM_LEDS; i++){
+            float gamma = i < stripLength ? CORRECT_GAMMA : 1.0f;
+            want[f][i].r = correct(buffer[i].r, gamma, 0);
+            want[f][i].g = correct(buffer[i].g, gamma, 1);
+            want[f][i].b = correct(buffer[i].b, gamma, 2);
+        }
+    }
+}
+
+// Compare a decoded frame with LEDs first to first+count-1 of frame f. Returns a description of
+// the first problem, or NULL.
+// Whether frame f decoded cleanly into count LEDs. Returns the problem, or NULL.
+static const char *checkWire(const SimFrame_t *frame, unsigned int channel, unsigned int f, unsigned int count){
+    static char problem[128];
+
+    if(frame->gaps || frame->badSymbols || frame->strayBits){
+        snprintf(problem, sizeof(problem), "channel %d frame %d: %d gaps, %d bad symbols, %d stray bits",
+                 channel, f, frame->gaps, frame->badSymbols, frame->strayBits);
+        return problem;
+    }
+    if(frame->pixels.size() != count){
+        snprintf(problem, sizeof(problem), "channel %d frame %d: %zu LEDs, expected %d", channel, f, frame->pixels.size(), count);
+        return problem;
+    }
+    return NULL;
+}
+
+static const char *checkFrame(const SimFrame_t *frame, unsigned int channel, unsigned int f, unsigned int first, unsigned int count){
+    static char problem[128];
+    const char *wrong = checkWire(frame, channel, f, count);
+    unsigned int i;
+
+    if(wrong != NULL){
+        return wrong;
+    }
+    for(i=0; i<count; i++){
+        Color_t expected = want[f][first + i];
+        Color_t got = frame->pixels[i];
+        if(got.r != expected.r || got.g != expected.g || got.b != expected.b){
+            snprintf(problem, sizeof(problem), "channel %d frame %d LED %d: %d,%d,%d, expected %d,%d,%d",
+                     channel, f, first + i, got.r, got.g, got.b, expected.r, expected.g, expected.b);
+            return problem;
+        }
+    }
+    return NULL;
+}
+
+// Decode one channel and compare it with LEDs first to first+count-1 of every frame, sent loops
+// times over. With faulted, FAULT_FRAME has to show up twice: broken, then sent again intact.
+// Returns a description of the first problem, or NULL.
+static const char *checkChannel(SimulatedBackend *sim, unsigned int channel, unsigned int first, unsigned int count, unsigned int loops,
+                                unsigned char faulted){
+    static char problem[128];
+    std::vector<SimFrame_t> frames = sim->decodeFrames(channel);
+    unsigned int sent = NUM_FRAMES * loops + (faulted ? 1 : 0);
+    unsigned int d, f;
+
+    if(frames.size() != sent){
+        snprintf(problem, sizeof(problem), "channel %d: %zu frames, expected %d", channel, frames.size(), sent);
+        return problem;
+    }
+    for(d=0; d<sent; d++){
+        f = (faulted && d > FAULT_FRAME ? d - 1 : d) % NUM_FRAMES;
+        if(faulted && d == FAULT_FRAME){
+            if(checkFrame(&frames[d], channel, f, first, count) == NULL){
+                snprintf(problem, sizeof(problem), "channel %d frame %d: the fault didn't show on the wire", channel, f);
+                return problem;
+            }
+            continue;
+        }
+        const char *wrong = checkFrame(&frames[d], channel, f, first, count);
+        if(wrong != NULL){
+            return wrong;
+        }
+    }
+    return NULL;
+}
+
+// Whether the frames on channel 1 were paced CAPTURE_INTERVAL_US apart. Returns the problem, or NULL.
+static const char *checkPacing(SimulatedBackend *sim){
+    static char problem[128];
+    std::vector<SimFrame_t> frames = sim->decodeFrames(1);
+    unsigned int n = frames.size();
+
+    if(n < 2){
+        return NULL;
+    }
+    unsigned long long spanNs = frames[n - 1].startNs - frames[0].startNs;
+    if(spanNs < (n - 1) * CAPTURE_INTERVAL_US * 500ULL){
+        snprintf(problem, sizeof(problem), "%d frames went out over %lluus, expected %dus",
+                 n, spanNs / 1000, (n - 1) * CAPTURE_INTERVAL_US);
+        return problem;
+    }
+    return NULL;
+}
+
+// Set strip up on sim the way case c asks. Returns false if the driver won't.
+static unsigned char setUp(const Case_t *c, ws2812b *strip, SimulatedBackend *sim){
+
+    // Pulse thresholds halfway between the two high times
+    double bitNs = 1e9 / c->dataRate;
+    sim->setPulseThresholds(bitNs / 2, bitNs * 0.9);
+
+    strip->setBackend(sim);
+    strip->setTransmitMode(c->mode);
+    strip->setRetryPolicy(c->fault ? 1 : 0);
+    if(c->fault){
+        sim->injectFault(c->fault, FAULT_FRAME, FAULT_WORD);
+    }
+    if(c->corrected){
+        strip->setGamma(0, CORRECT_GAMMA);
+        strip->setBrightness(CORRECT_BRIGHTNESS);
+        strip->setWhiteBalance(whiteBalance[0], whiteBalance[1], whiteBalance[2]);
+    }
+    if(c->dithered && !strip->enableDithering(true)){
+        return false;
+    }
+    return strip->setWireFormat(c->dataRate, c->symbolBits) && strip->initHardware();
+}
+
+// Show the next frame the way case c asks
+static void showFrame(const Case_t *c, ws2812b *strip){
+    if(c->async){
+        // Queue behind the previous frame instead of replacing it
+        strip->waitForQueue();
+        strip->showAsync();
+    } else {
+        strip->show();
+    }
+}
+
+// Wait until the last frame shown is all out on the wire
+static void waitForWire(const Case_t *c, ws2812b *strip, unsigned int stripLength){
+    strip->waitForFrame();
+
+    // show() in DMA mode returns as soon as the DMA is started, so give the last frame time to go
+    // out and its reset time to pass before the decoder looks for its end
+    usleep(stripLength * 24 * 1000000ULL / c->dataRate + LED_RESET_US * 4);
+}
+
+// Run one case. Returns NULL if it passed, the problem otherwise; *underrun is set if the driver
+// itself saw the FIFO run dry.
+static const char *runCase(const Case_t *c, unsigned char *underrun){
+    SimulatedBackend *sim = new SimulatedBackend();
+    ws2812b *strip = new ws2812b(NUM_LEDS, c->strips);
+    unsigned int stripLength = (NUM_LEDS + c->strips - 1) / c->strips;
+    const char *problem = NULL;
+    static char statsProblem[128];
+    unsigned int loops = c->captured ? CAPTURE_LOOPS : 1;
+    FrameSequence_t sequence;
+    OutputStats_t stats;
+    unsigned int f, i;
+
+    expectFrames(c);
+    initFrameSequence(&sequence);
+    if(!setUp(c, strip, sim)){
+        problem = "unable to set up the strip";
+    } else {
+        for(f=0; f<NUM_FRAMES; f++){
+            for(i=0; i<NUM_LEDS; i++){
+                if(isSet(c, f, i)){
+                    Color_t color = pattern(f, i);
+                    strip->setPixelColor(i, color.r, color.g, color.b);
+                }
+            }
+            if(c->captured){
+                strip->captureFrame(&sequence, CAPTURE_INTERVAL_US);
+            } else {
+                showFrame(c, strip);
+            }
+        }
+        if(c->captured){
+            if(sim->counters().framesStarted != 0){
+                problem = "captureFrame() sent a frame";
+            }
+            strip->playFrames(&sequence, CAPTURE_LOOPS);
+        }
+        waitForWire(c, strip, stripLength);
+        strip->getStats(&stats);
+        SimCounters_t counters = sim->counters();
+        *underrun = stats.gapErrors > (c->fault == SIM_FAULT_GAP ? 1u : 0u);
+
+        if(problem == NULL){
+            problem = checkChannel(sim, 1, 0, stripLength, loops, c->fault != 0);
+        }
+        if(problem == NULL && c->strips == 2){
+            problem = checkChannel(sim, 2, stripLength, NUM_LEDS - stripLength, loops, c->fault != 0);
+        }
+        if(problem == NULL && c->captured){
+            problem = checkPacing(sim);
+        }
+        if(problem == NULL && c->fault){
+            if(counters.faults != 1){
+                problem = "the fault was never forced";
+            } else if(stats.retransmits != 1 || counters.framesStarted != NUM_FRAMES + 1){
+                snprintf(statsProblem, sizeof(statsProblem), "%llu retransmits and %lu frames sent, expected 1 and %d",
+                         stats.retransmits, counters.framesStarted, NUM_FRAMES + 1);
+                problem = statsProblem;
+            } else if(c->fault == SIM_FAULT_GAP ? stats.gapErrors == 0 : stats.readErrors == 0){
+                problem = "the driver didn't count the error";
+            }
+        }
+    }
+
+    freeFrameSequence(&sequence);
+    delete strip;
+    delete sim;
+    return problem;
+}
+
+// Average DITHER_FRAMES decoded frames of one channel, which holds LEDs first to first+count-1,
+// and compare every color of every LED with what it should average out to. Returns the problem,
+// or NULL.
+static const char *checkDither(const Case_t *c, SimulatedBackend *sim, unsigned int channel, unsigned int first, unsigned int count,
+                               float gamma){
+    static char problem[128];
+    std::vector<SimFrame_t> frames = sim->decodeFrames(channel);
+    unsigned int f, i, color;
+
+    if(frames.size() != DITHER_FRAMES){
+        snprintf(problem, sizeof(problem), "channel %d: %zu frames, expected %d", channel, frames.size(), DITHER_FRAMES);
+        return problem;
+    }
+    for(f=0; f<DITHER_FRAMES; f++){
+        const char *wrong = checkWire(&frames[f], channel, f, count);
+        if(wrong != NULL){
+            return wrong;
+        }
+    }
+    for(i=0; i<count; i++){
+        Color16_t set = pattern16(first + i);
+        unsigned short values[3] = { set.r, set.g, set.b };
+        for(color=0; color<3; color++){
+            double sum = 0;
+            for(f=0; f<DITHER_FRAMES; f++){
+                Color_t got = frames[f].pixels[i];
+                sum += color == 0 ? got.r : color == 1 ? got.g : got.b;
+            }
+            double mean = sum / DITHER_FRAMES;
+            double target = ditherTarget(c, values[color], gamma, color);
+            if(fabs(mean - target) > DITHER_TOLERANCE){
+                snprintf(problem, sizeof(problem), "channel %d LED %d color %d: averages %.3f, expected %.3f",
+                         channel, first + i, color, mean, target);
+                return problem;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Run one dithered case, as runCase() does
+static const char *runDitherCase(const Case_t *c, unsigned char *underrun){
+    SimulatedBackend *sim = new SimulatedBackend();
+    ws2812b *strip = new ws2812b(NUM_LEDS, c->strips);
+    unsigned int stripLength = (NUM_LEDS + c->strips - 1) / c->strips;
+    const char *problem = NULL;
+    OutputStats_t stats;
+    unsigned int f, i;
+
+    if(!setUp(c, strip, sim)){
+        problem = "unable to set up the strip";
+    } else {
+        for(f=0; f<DITHER_FRAMES; f++){
+            // Every frame, since showAsync() swaps buffers
+            for(i=0; i<NUM_LEDS; i++){
+                Color16_t color = pattern16(i);
+                strip->setPixelColor16(i, color.r, color.g, color.b);
+            }
+            showFrame(c, strip);
+        }
+        waitForWire(c, strip, stripLength);
+        strip->getStats(&stats);
+        *underrun = stats.gapErrors > 0;
+
+        problem = checkDither(c, sim, 1, 0, stripLength, c->corrected ? CORRECT_GAMMA : 1.0f);
+        if(problem == NULL && c->strips == 2){
+            problem = checkDither(c, sim, 2, stripLength, NUM_LEDS - stripLength, 1.0f);
+        }
+    }
+
+    delete strip;
+    delete sim;
+    return problem;
+}
+
+int main(int argc, char **argv){
+
+    unsigned int failures = 0;
+    unsigned int c, attempt;
+
+    for(c=0; c<sizeof(cases) / sizeof(cases[0]); c++){
+        const char *problem;
+        unsigned char underrun = false;
+
+        for(attempt=1; ; attempt++){
+            problem = cases[c].dithered ? runDitherCase(&cases[c], &underrun) : runCase(&cases[c], &underrun);
+            if(problem == NULL || !underrun || cases[c].mode != TX_MODE_FIFO || attempt == MAX_ATTEMPTS){
+                break;
+            }
+            usleep(attempt * RETRY_PAUSE_MS * 1000);
+        }
+
+        if(problem == NULL){
+            printf("ok    %s%s\n", cases[c].name, attempt > 1 ? " (after FIFO underruns)" : "");
+        } else {
+            printf("FAIL  %s: %s%s\n", cases[c].name, problem, underrun ? " (FIFO underrun)" : "");
+            failures++;
+        }
+    }
+
+    if(failures){
+        printf("%d of %zu cases failed\n", failures, sizeof(cases) / sizeof(cases[0]));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include "animation.h"
+#include "encoder.h"
+
+// Convert a raw RGB frame dump into a pre-encoded animation file for neo-play.
+// The input is a sequence of frames of numLEDs packed R, G, B bytes each ("-" reads stdin).
+// Needs nothing from the Pi, so it runs on any Linux box.
+int main(int argc, char **argv){
+
+    if(argc != 5){
+        printf("Usage: %s <numLEDs> <frameIntervalUs> <input.rgb|-> <output.ws2b>\n", argv[0]);
+        return 1;
+    }
+
+    unsigned int numLEDs = strtoul(argv[1], NULL, 0);
+    unsigned int frameIntervalUs = strtoul(argv[2], NULL, 0);
+    if(numLEDs == 0){
+        printf("numLEDs must be at least 1\n");
+        return 1;
+    }
+
+    FILE *in = strcmp(argv[3], "-") == 0 ? stdin : fopen(argv[3], "rb");
+    if(in == NULL){
+        printf("Unable to open %s\n", argv[3]);
+        return 1;
+    }
+
+    AnimationWriter_t writer;
+    if(!createAnimation(argv[4], numLEDs, frameIntervalUs, &writer)){
+        return 1;
+    }
+
+    WireTable_t table;
+    buildWireTable(&table);
+
+    Color_t *frame = (Color_t *)malloc(numLEDs * sizeof(Color_t));
+    unsigned int *wire = (unsigned int *)malloc(WIRE_WORDS(numLEDs) * sizeof(unsigned int));
+    size_t got;
+
+    while((got = fread(frame, sizeof(Color_t), numLEDs, in)) == numLEDs){
+        encodeWire(&table, frame, numLEDs, wire);
+        if(!writeAnimationFrame(&writer, wire)){
+            return 1;
+        }
+    }
+    if(got != 0){
+        printf("Ignoring %d trailing pixels (not a whole frame)\n", (int)got);
+    }
+
+    if(!finishAnimation(&writer)){
+        return 1;
+    }
+    printf("Wrote %d frames of %d LEDs\n", writer.header.numFrames, numLEDs);
+
+    free(wire);
+    free(frame);
+    if(in != stdin){
+        fclose(in);
+    }
+    return 0;
+}
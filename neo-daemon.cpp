@@ -0,0 +1,74 @@
+#include <signal.h>
+
+#include "ws2812b.h"
+#include "framering.h"
+
+// Own the strip and show whatever frames producers publish into a shared-memory frame ring
+// (see framering.h), so the programs rendering them can run unprivileged. Runs until killed.
+
+// How long to sleep when the ring is empty
+#define RING_POLL_US 500
+
+static volatile sig_atomic_t running = 1;
+
+static void stopRunning(int sig){
+    running = 0;
+}
+
+int main(int argc, char **argv){
+
+    if(argc < 3){
+        printf("Usage: %s <name> <numLEDs> [numStrips, 1-2] [slots, a power of two]\n", argv[0]);
+        return 1;
+    }
+
+    unsigned int numLEDs = strtoul(argv[2], NULL, 0);
+    unsigned int numStrips = argc > 3 ? strtoul(argv[3], NULL, 0) : 1;
+    unsigned int numSlots = argc > 4 ? strtoul(argv[4], NULL, 0) : 4;
+    if(numLEDs == 0 || numStrips < 1 || numStrips > 2){
+        printf("Need at least one LED on one or two strips\n");
+        return 1;
+    }
+
+    FrameRing_t ring;
+    if(!createFrameRing(argv[1], numLEDs, numSlots, &ring)){
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stopRunning;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    ws2812b *_ws2812b = new ws2812b(numLEDs, numStrips);
+    _ws2812b->setTransmitMode(TX_MODE_DMA);
+    if(!_ws2812b->initHardware()){
+        closeFrameRing(&ring);
+        return 1;
+    }
+
+    // Each frame is copied into the back buffer and the slot handed straight back, so the
+    // producer can render the next one while this one goes out. A frame is only taken once the
+    // output thread is ready for it, so a fast producer fills the ring and waits rather than
+    // having frames dropped.
+    while(running){
+        _ws2812b->waitForQueue();
+        const Color_t *frame = nextFrame(&ring);
+        if(frame == NULL){
+            usleep(RING_POLL_US);
+            continue;
+        }
+        _ws2812b->setPixels(0, numLEDs, frame);
+        releaseFrame(&ring);
+        _ws2812b->showAsync();
+    }
+
+    _ws2812b->waitForFrame();
+    _ws2812b->clearLEDBuffer();
+    _ws2812b->show();
+    delete _ws2812b;
+    closeFrameRing(&ring);
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <signal.h>
+
+#include "ws2812b.h"
+#include "scheduler.h"
+#include "effects.h"
+
+// A moving rainbow with a white chase added on top, rendered by the effects engine on every core
+// but the output thread's and sent at a fixed frame rate. Runs until killed.
+
+static FrameScheduler *scheduler = NULL;
+
+static void stopScheduler(int sig){
+    if(scheduler != NULL){
+        scheduler->stop();
+    }
+}
+
+static unsigned char renderFrame(void *arg, unsigned long frame, ws2812b *strip){
+    ((EffectEngine *)arg)->render(monotonicNs());
+    return true;
+}
+
+int main(int argc, char **argv){
+
+    if(argc < 2){
+        printf("Usage: %s <numLEDs> [numStrips, 1-2] [fps] [workers]\n", argv[0]);
+        return 1;
+    }
+
+    unsigned int numLEDs = strtoul(argv[1], NULL, 0);
+    unsigned int numStrips = argc > 2 ? strtoul(argv[2], NULL, 0) : 1;
+    double fps = argc > 3 ? strtod(argv[3], NULL) : 60.0;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int workers = argc > 4 ? strtoul(argv[4], NULL, 0) : (cpus > 2 ? cpus - 2 : 0);
+    if(numLEDs == 0 || numStrips < 1 || numStrips > 2 || fps <= 0){
+        printf("Need at least one LED on one or two strips, and a frame rate\n");
+        return 1;
+    }
+
+    ws2812b *_ws2812b = new ws2812b(numLEDs, numStrips);
+    _ws2812b->setTransmitMode(TX_MODE_DMA);
+    if(!_ws2812b->initHardware()){
+        return 1;
+    }
+
+    EffectEngine *effects = new EffectEngine(_ws2812b, numLEDs, workers);
+    EffectLayer_t layer;
+
+    initLayer(&layer, EFFECT_RAINBOW, 0, numLEDs);
+    layer.period = numLEDs < 150 ? numLEDs : 150;
+    layer.speed = 30;
+    effects->addLayer(&layer);
+
+    initLayer(&layer, EFFECT_CHASE, 0, numLEDs);
+    layer.blend = BLEND_ADD;
+    layer.opacity = 160;
+    layer.period = 25;
+    layer.width = 2;
+    layer.speed = -60;
+    effects->addLayer(&layer);
+
+    scheduler = new FrameScheduler(_ws2812b, fps);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stopScheduler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    scheduler->run(renderFrame, effects, 0);
+    scheduler->printStats();
+
+    EffectStats_t stats;
+    effects->getStats(&stats);
+    if(stats.frames){
+        printf("Render: %.1f us mean, %.1f us max (%d workers)\n",
+               stats.renderNs / 1000.0 / stats.frames, stats.renderMaxNs / 1000.0, workers);
+    }
+
+    delete scheduler;
+    delete effects;
+    _ws2812b->clearLEDBuffer();
+    _ws2812b->show();
+    delete _ws2812b;
+
+    return 0;
+}
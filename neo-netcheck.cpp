@@ -0,0 +1,306 @@
+#include <arpa/inet.h>
+
+#include "ws2812b.h"
+#include "netserver.h"
+#include "simulator.h"
+
+// Check NetServer without a Pi or any lighting software. The server runs against
+// SimulatedBackend on ports of its own, and this sends it Open Pixel Control over TCP and E1.31
+// over UDP on the loopback interface: whole frames, a multi-universe frame that loses a universe
+// and has to be flushed partial, late and duplicate sequence numbers, a source restarting its
+// sequence and a sequence wrapping around. After every step the server's NetStats_t has to match
+// what was sent, and the last frame decoded off the modeled wire has to hold the right pixels.
+// Prints one line per step and exits with status 1 if any fails.
+
+#define NUM_LEDS        120
+#define PER_UNIVERSE    50      // So the strip spans 3 universes: 50, 50 and 20 LEDs
+#define NUM_UNIVERSES   ((NUM_LEDS + PER_UNIVERSE - 1) / PER_UNIVERSE)
+#define FIRST_UNIVERSE  1
+#define CHECK_OPC_PORT  17890
+#define CHECK_E131_PORT 15568
+#define WAIT_MS         2000    // For the server to catch up with a step
+
+static SimulatedBackend *sim;
+static ws2812b *strip;
+static NetServer *server;
+static int opcSocket, e131Socket;
+
+static NetStats_t want;         // What the server should have counted so far
+static Color_t shown[NUM_LEDS]; // What the last frame should show
+static unsigned int failures;
+
+// What LED i is in the frames tagged tag
+static Color_t pattern(unsigned int tag, unsigned int i){
+    Color_t color;
+    color.r = tag * 40 + i;
+    color.g = 255 - i;
+    color.b = (tag * 85) ^ i;
+    return color;
+}
+
+static void *serve(void *arg){
+    server->run();
+    return NULL;
+}
+
+// Pixels of LEDs first to first+count-1 as R, G, B bytes
+static unsigned int packPixels(unsigned char *out, unsigned int tag, unsigned int first, unsigned int count){
+    unsigned int i;
+    for(i=0; i<count; i++){
+        Color_t color = pattern(tag, first + i);
+        out[i*3] = color.r;
+        out[i*3 + 1] = color.g;
+        out[i*3 + 2] = color.b;
+    }
+    return count * 3;
+}
+
+static void sendOPC(unsigned char command, unsigned int tag){
+    unsigned char message[4 + NUM_LEDS * 3];
+    unsigned int length = packPixels(message + 4, tag, 0, NUM_LEDS);
+    message[0] = 0;
+    message[1] = command;
+    message[2] = length >> 8;
+    message[3] = length & 0xff;
+    if(write(opcSocket, message, 4 + length) != (ssize_t)(4 + length)){
+        printf("Unable to send an OPC message\n");
+    }
+}
+
+// Send universe FIRST_UNIVERSE + index with sequence number seq, carrying the LEDs of frame tag
+static void sendE131(unsigned int index, unsigned char seq, unsigned int tag, unsigned char options = 0){
+    static const unsigned char identifier[12] = { 'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0, 0, 0 };
+    unsigned char packet[126 + 512];
+    unsigned int universe = FIRST_UNIVERSE + index;
+    unsigned int first = index * PER_UNIVERSE;
+    unsigned int count = NUM_LEDS - first < PER_UNIVERSE ? NUM_LEDS - first : PER_UNIVERSE;
+    unsigned int slots = packPixels(packet + 126, tag, first, count);
+    unsigned int length = 126 + slots;
+    struct sockaddr_in addr;
+
+    memset(packet, 0, 126);
+    packet[1] = 0x10;                           // Preamble size
+    memcpy(packet + 4, identifier, sizeof(identifier));
+    packet[16] = 0x70 | ((length - 16) >> 8);   // Root layer flags and length
+    packet[17] = (length - 16) & 0xff;
+    packet[21] = 0x04;                          // Root vector: data
+    packet[38] = 0x70 | ((length - 38) >> 8);   // Framing layer
+    packet[39] = (length - 38) & 0xff;
+    packet[43] = 0x02;                          // Framing vector: data packet
+    strcpy((char *)packet + 44, "neo-netcheck");
+    packet[108] = 100;                          // Priority
+    packet[111] = seq;
+    packet[112] = options;
+    packet[113] = universe >> 8;
+    packet[114] = universe & 0xff;
+    packet[115] = 0x70 | ((length - 115) >> 8); // DMP layer
+    packet[116] = (length - 115) & 0xff;
+    packet[117] = 0x02;                         // Set property
+    packet[118] = 0xa1;                         // Address and data types
+    packet[122] = 1;                            // Address increment
+    packet[123] = (slots + 1) >> 8;             // Value count, with the start code
+    packet[124] = (slots + 1) & 0xff;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(CHECK_E131_PORT);
+    if(sendto(e131Socket, packet, length, 0, (struct sockaddr *)&addr, sizeof(addr)) != (ssize_t)length){
+        printf("Unable to send an E1.31 packet\n");
+    }
+}
+
+// The next frame should show universe index as it is in frame tag
+static void expectUniverse(unsigned int index, unsigned int tag){
+    unsigned int i;
+    for(i=index * PER_UNIVERSE; i<NUM_LEDS && i<(index + 1) * PER_UNIVERSE; i++){
+        shown[i] = pattern(tag, i);
+    }
+}
+
+// Wait for the server's counters to reach want, then compare the frames on the wire with them
+static void check(const char *name){
+    static char problem[160];
+    NetStats_t got;
+    unsigned int waited, i;
+
+    problem[0] = 0;
+    for(waited=0; ; waited++){
+        server->getStats(&got);
+        if(memcmp(&got, &want, sizeof(got)) == 0 || waited == WAIT_MS){
+            break;
+        }
+        usleep(1000);
+    }
+
+    if(memcmp(&got, &want, sizeof(got)) != 0){
+        snprintf(problem, sizeof(problem), "counted %lu frames, %lu OPC, %lu E1.31, %lu partial, %lu dropped; expected %lu, %lu, %lu, %lu, %lu",
+                 got.frames, got.opcMessages, got.e131Packets, got.partialFrames, got.dropped,
+                 want.frames, want.opcMessages, want.e131Packets, want.partialFrames, want.dropped);
+    } else {
+        // show() returns as soon as the DMA is started, so let the last frame go out first
+        usleep(NUM_LEDS * 24 * 1000000ULL / DATA_RATE_WS2812B + LED_RESET_US * 4);
+        std::vector<SimFrame_t> frames = sim->decodeFrames();
+        if(frames.size() != want.frames){
+            snprintf(problem, sizeof(problem), "%zu frames on the wire, expected %lu", frames.size(), want.frames);
+        } else if(frames.size() > 0){
+            const SimFrame_t *frame = &frames.back();
+            if(frame->gaps || frame->badSymbols || frame->strayBits || frame->pixels.size() != NUM_LEDS){
+                snprintf(problem, sizeof(problem), "last frame has %zu LEDs, %d gaps, %d bad symbols, %d stray bits",
+                         frame->pixels.size(), frame->gaps, frame->badSymbols, frame->strayBits);
+            }
+            for(i=0; i<NUM_LEDS && problem[0] == 0; i++){
+                Color_t g = frame->pixels[i];
+                if(g.r != shown[i].r || g.g != shown[i].g || g.b != shown[i].b){
+                    snprintf(problem, sizeof(problem), "LED %d is %d,%d,%d, expected %d,%d,%d",
+                             i, g.r, g.g, g.b, shown[i].r, shown[i].g, shown[i].b);
+                }
+            }
+        }
+    }
+
+    if(problem[0] == 0){
+        printf("ok    %s\n", name);
+    } else {
+        printf("FAIL  %s: %s\n", name, problem);
+        failures++;
+        // Carry on from what the server actually did
+        want = got;
+    }
+}
+
+int main(int argc, char **argv){
+
+    struct sockaddr_in addr;
+    pthread_t thread;
+    unsigned int i;
+
+    sim = new SimulatedBackend();
+    sim->setPulseThresholds(1e9 / DATA_RATE_WS2812B / 2, 1e9 / DATA_RATE_WS2812B * 0.9);
+    strip = new ws2812b(NUM_LEDS, 1);
+    strip->setBackend(sim);
+    strip->setTransmitMode(TX_MODE_DMA);
+    if(!strip->initHardware()){
+        return 1;
+    }
+
+    server = new NetServer(strip, NUM_LEDS);
+    if(!server->listenOPC(CHECK_OPC_PORT) || !server->listenE131(CHECK_E131_PORT, FIRST_UNIVERSE, PER_UNIVERSE)){
+        return 1;
+    }
+    pthread_create(&thread, NULL, serve, NULL);
+
+    opcSocket = socket(AF_INET, SOCK_STREAM, 0);
+    e131Socket = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(CHECK_OPC_PORT);
+    if(opcSocket < 0 || e131Socket < 0 || connect(opcSocket, (struct sockaddr *)&addr, sizeof(addr)) != 0){
+        printf("Unable to connect to the server\n");
+        return 1;
+    }
+    memset(&want, 0, sizeof(want));
+
+    // OPC: a frame per message; anything but "set pixel colors" is dropped
+    sendOPC(0, 1);
+    for(i=0; i<NUM_LEDS; i++){
+        shown[i] = pattern(1, i);
+    }
+    want.opcMessages++;
+    want.frames++;
+    check("opc frame");
+
+    sendOPC(0xff, 2);
+    want.dropped++;
+    check("opc system exclusive dropped");
+
+    // E1.31: every universe arrives, one frame
+    for(i=0; i<NUM_UNIVERSES; i++){
+        sendE131(i, 1, 2);
+        expectUniverse(i, 2);
+    }
+    want.e131Packets += NUM_UNIVERSES;
+    want.frames++;
+    check("e131 whole frame");
+
+    // The last universe of a frame is lost, so the first turning up again flushes what there is.
+    // It then starts the next frame, which the others complete.
+    sendE131(0, 2, 3);
+    sendE131(1, 2, 3);
+    expectUniverse(0, 3);
+    expectUniverse(1, 3);
+    sendE131(0, 3, 4);
+    want.e131Packets += 3;
+    want.partialFrames++;
+    want.frames++;
+    check("e131 partial frame flushed");
+
+    expectUniverse(0, 4);
+    for(i=1; i<NUM_UNIVERSES; i++){
+        sendE131(i, 3, 4);
+        expectUniverse(i, 4);
+    }
+    want.e131Packets += NUM_UNIVERSES - 1;
+    want.frames++;
+    check("e131 frame after the flush");
+
+    // Behind the last sequence number by less than 20, or the same one again: dropped
+    sendE131(0, 2, 9);
+    sendE131(0, 3, 9);
+    sendE131(1, 3 - 19, 9);
+    want.dropped += 3;
+    check("e131 late and duplicate packets dropped");
+
+    // 20 or more behind is the source starting over, so it's taken
+    sendE131(0, 3 - 20, 5);
+    for(i=1; i<NUM_UNIVERSES; i++){
+        sendE131(i, 4, 5);
+    }
+    for(i=0; i<NUM_UNIVERSES; i++){
+        expectUniverse(i, 5);
+    }
+    want.e131Packets += NUM_UNIVERSES;
+    want.frames++;
+    check("e131 sequence restart taken");
+
+    // Universe 0 is now at 239: 255 and then 0 carry on across the wrap
+    sendE131(0, 255, 6);
+    for(i=1; i<NUM_UNIVERSES; i++){
+        sendE131(i, 5, 6);
+    }
+    for(i=0; i<NUM_UNIVERSES; i++){
+        expectUniverse(i, 6);
+    }
+    sendE131(0, 0, 7);
+    for(i=1; i<NUM_UNIVERSES; i++){
+        sendE131(i, 6, 7);
+    }
+    for(i=0; i<NUM_UNIVERSES; i++){
+        expectUniverse(i, 7);
+    }
+    want.e131Packets += 2 * NUM_UNIVERSES;
+    want.frames += 2;
+    check("e131 sequence wraps around");
+
+    // Universes the strip doesn't span, preview data and terminated streams aren't shown
+    sendE131(NUM_UNIVERSES, 1, 8);
+    sendE131(0, 1, 8, 0x80);
+    sendE131(0, 1, 8, 0x40);
+    want.dropped += 3;
+    check("e131 other universe, preview and terminated dropped");
+
+    server->stop();
+    pthread_join(thread, NULL);
+    close(opcSocket);
+    close(e131Socket);
+    delete server;
+    delete strip;
+    delete sim;
+
+    if(failures){
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
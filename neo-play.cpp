@@ -0,0 +1,30 @@
+#include "ws2812b.h"
+#include "animation.h"
+
+// Play a pre-encoded animation file (see neo-convert) straight from its memory mapping
+int main(int argc, char **argv){
+
+    if(argc < 2){
+        printf("Usage: %s <animation.ws2b> [loops, 0=forever]\n", argv[0]);
+        return 1;
+    }
+
+    Animation_t anim;
+    if(!openAnimation(argv[1], &anim)){
+        return 1;
+    }
+    unsigned int loops = argc > 2 ? strtoul(argv[2], NULL, 0) : 0;
+
+    ws2812b *_ws2812b = new ws2812b(anim.header->numLEDs);
+    _ws2812b->setTransmitMode(TX_MODE_DMA);
+    if(!_ws2812b->initHardware()){
+        return 1;
+    }
+
+    _ws2812b->playAnimation(&anim, loops);
+
+    delete _ws2812b;
+    closeAnimation(&anim);
+
+    return 0;
+}
@@ -0,0 +1,63 @@
+#include <signal.h>
+
+#include "ws2812b.h"
+#include "netserver.h"
+
+// Show frames sent over the network with Open Pixel Control (TCP) or E1.31 (UDP). Runs until
+// killed.
+
+static NetServer *server = NULL;
+
+static void stopServer(int sig){
+    if(server != NULL){
+        server->stop();
+    }
+}
+
+int main(int argc, char **argv){
+
+    if(argc < 2){
+        printf("Usage: %s <numLEDs> [numStrips, 1-2] [first universe] [LEDs per universe]\n", argv[0]);
+        return 1;
+    }
+
+    unsigned int numLEDs = strtoul(argv[1], NULL, 0);
+    unsigned int numStrips = argc > 2 ? strtoul(argv[2], NULL, 0) : 1;
+    unsigned int firstUniverse = argc > 3 ? strtoul(argv[3], NULL, 0) : 1;
+    unsigned int perUniverse = argc > 4 ? strtoul(argv[4], NULL, 0) : E131_PIXELS_PER_UNIVERSE;
+    if(numLEDs == 0 || numStrips < 1 || numStrips > 2){
+        printf("Need at least one LED on one or two strips\n");
+        return 1;
+    }
+
+    ws2812b *_ws2812b = new ws2812b(numLEDs, numStrips);
+    _ws2812b->setTransmitMode(TX_MODE_DMA);
+    if(!_ws2812b->initHardware()){
+        return 1;
+    }
+
+    server = new NetServer(_ws2812b, numLEDs);
+    if(!server->listenOPC(OPC_PORT) || !server->listenE131(E131_PORT, firstUniverse, perUniverse)){
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stopServer;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    server->run();
+
+    NetStats_t stats;
+    server->getStats(&stats);
+    printf("%lu frames (%lu OPC messages, %lu E1.31 packets, %lu partial frames, %lu dropped)\n",
+           stats.frames, stats.opcMessages, stats.e131Packets, stats.partialFrames, stats.dropped);
+
+    delete server;
+    _ws2812b->clearLEDBuffer();
+    _ws2812b->show();
+    delete _ws2812b;
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include "ws2812b.h"
+
+// Print the output statistics another process publishes with ws2812b::publishStats().
+// With an interval, keeps printing them every intervalMs milliseconds along with the frame rate.
+static unsigned char readStats(const StatsPage_t *page, OutputStats_t *stats){
+    unsigned int sequence;
+    unsigned int tries = 0;
+    do {
+        if(++tries > 1000){
+            return false;
+        }
+        sequence = page->sequence;
+        __sync_synchronize();
+        memcpy(stats, (const void *)&page->stats, sizeof(OutputStats_t));
+        __sync_synchronize();
+    } while((sequence & 1) || sequence != page->sequence);
+    return true;
+}
+
+static void printStats(const OutputStats_t *s){
+    printf("Frames: %llu\n", s->frames);
+    printf("Encode: %llu ranges, mean %llu us, max %llu us\n", s->encodes,
+           s->encodes ? s->encodeNs / s->encodes / 1000 : 0, s->encodeMaxNs / 1000);
+    printf("Fill: mean %llu us, max %llu us\n",
+           s->frames ? s->fillNs / s->frames / 1000 : 0, s->fillMaxNs / 1000);
+    printf("Wait for idle: mean %llu us\n", s->frames ? s->waitNs / s->frames / 1000 : 0);
+    printf("Errors: gap %llu, FIFO read %llu, FIFO write %llu, bus %llu, DMA %llu\n",
+           s->gapErrors, s->readErrors, s->writeErrors, s->busErrors, s->dmaErrors);
+    printf("Retransmitted: %llu, still corrupted: %llu\n", s->retransmits, s->corruptFrames);
+}
+
+int main(int argc, char **argv){
+
+    if(argc < 2 || argc > 3){
+        printf("Usage: %s <name> [intervalMs]\n", argv[0]);
+        return 1;
+    }
+    unsigned int intervalMs = argc == 3 ? strtoul(argv[2], NULL, 0) : 0;
+
+    int fd = shm_open(argv[1], O_RDONLY, 0);
+    if(fd < 0){
+        printf("Unable to open shared memory %s\n", argv[1]);
+        return 1;
+    }
+    const StatsPage_t *page = (const StatsPage_t *)mmap(NULL, sizeof(StatsPage_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(page == MAP_FAILED){
+        printf("Unable to map shared memory %s\n", argv[1]);
+        return 1;
+    }
+    if(memcmp(page->magic, STATS_MAGIC, 4) != 0 || page->version != STATS_VERSION){
+        printf("%s doesn't hold ws2812b statistics\n", argv[1]);
+        return 1;
+    }
+
+    OutputStats_t stats, last;
+    unsigned long long lastNs = monotonicNs();
+    memset(&last, 0, sizeof(last));
+    do {
+        if(!readStats(page, &stats)){
+            printf("Statistics keep changing, giving up\n");
+            return 1;
+        }
+        printf("%u LEDs\n", page->numLEDs);
+        printStats(&stats);
+        if(intervalMs){
+            unsigned long long now = monotonicNs();
+            if(last.frames){
+                printf("Rate: %.2f fps\n", (stats.frames - last.frames) * 1e9 / (now - lastNs));
+            }
+            printf("\n");
+            last = stats;
+            lastNs = now;
+            usleep(intervalMs * 1000);
+        }
+    } while(intervalMs);
+
+    return 0;
+}
@@ -1,49 +1,48 @@
 #include "ws2812b.h"
 
 int main(int argc, char **argv){
-	
+
 	ws2812b *_ws2812b = new ws2812b(1); //1 pixel LED
-    _ws2812b->initHardware();
+    if(!_ws2812b->initHardware()){
+        return 1;
+    }
     _ws2812b->clearLEDBuffer();
 
     int tmp;
 
-    for(;;){
-		//RGB Blink.
-		_ws2812b->setPixelColor(0, 255, 0, 0);
-		_ws2812b->show();
-		usleep(1000*1000);
-		
-		_ws2812b->setPixelColor(0, 0, 255, 0);
-		_ws2812b->show();
-		usleep(1000*1000);
-		
-		_ws2812b->setPixelColor(0, 0, 0, 255);
-		_ws2812b->show();
-		usleep(1000*1000);
-
-		//Rainbow
-        for( int i=0 ; i<=255 ; i++){
-            if( i < 85 ){
-                _ws2812b->setPixelColor(0, i*3, 255-i*3, 0);
-                _ws2812b->show();
-            }else if( i < 170 ){
-                tmp = i-85;
-                _ws2812b->setPixelColor(0, 255-tmp*3, 0, tmp*3);
-                _ws2812b->show();
-            }else{
-                tmp = i-170;
-                _ws2812b->setPixelColor(0, 0, tmp*3, 255-tmp*3);
-                _ws2812b->show();
-            }
-            usleep(1000);
-        }
-		
-		usleep(1000*1000);
+    // The animation never changes, so encode it once and replay the wire frames forever
+    FrameSequence_t animation;
+    initFrameSequence(&animation);
+
+    //RGB Blink.
+    _ws2812b->setPixelColor(0, 255, 0, 0);
+    _ws2812b->captureFrame(&animation, 1000*1000);
+
+    _ws2812b->setPixelColor(0, 0, 255, 0);
+    _ws2812b->captureFrame(&animation, 1000*1000);
 
+    _ws2812b->setPixelColor(0, 0, 0, 255);
+    _ws2812b->captureFrame(&animation, 1000*1000);
+
+    //Rainbow
+    for( int i=0 ; i<=255 ; i++){
+        if( i < 85 ){
+            _ws2812b->setPixelColor(0, i*3, 255-i*3, 0);
+        }else if( i < 170 ){
+            tmp = i-85;
+            _ws2812b->setPixelColor(0, 255-tmp*3, 0, tmp*3);
+        }else{
+            tmp = i-170;
+            _ws2812b->setPixelColor(0, 0, tmp*3, 255-tmp*3);
+        }
+        // Hold the last step for a second before the blink starts again
+        _ws2812b->captureFrame(&animation, i < 255 ? 1000 : 1000 + 1000*1000);
     }
-	
+
+    _ws2812b->playFrames(&animation, 0);
+
+    freeFrameSequence(&animation);
 	delete _ws2812b;
 
     return 0;
-}
\ No newline at end of file
+}
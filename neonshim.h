@@ -0,0 +1,89 @@
+#ifndef NEONSHIM_H
+#define NEONSHIM_H
+
+#include <stdint.h>
+
+// NEON intrinsics in plain C
+// -------------------------------------------------------------------------------------------------
+// Just the intrinsics encodeWireNEON() uses, written out lane by lane with the semantics the ARM
+// reference gives them. Building with -DNEON_SHIM on a machine without NEON compiles the NEON
+// encoder against these instead of <arm_neon.h>, so its output can be checked against the other
+// encoders on an ordinary x86 box (see neo-bench). It's only for checking: encoderAvailable() still
+// says no, so setEncoder() never picks it.
+
+typedef struct { uint8_t lane[8]; } uint8x8_t;
+typedef struct { uint8_t lane[16]; } uint8x16_t;
+typedef struct { uint8x8_t val[3]; } uint8x8x3_t;
+
+static inline uint8x8_t vld1_u8(const uint8_t *p) {
+	uint8x8_t r;
+	for(int i=0; i<8; i++) r.lane[i] = p[i];
+	return r;
+}
+
+static inline uint8x16_t vld1q_u8(const uint8_t *p) {
+	uint8x16_t r;
+	for(int i=0; i<16; i++) r.lane[i] = p[i];
+	return r;
+}
+
+static inline void vst1_u8(uint8_t *p, uint8x8_t v) {
+	for(int i=0; i<8; i++) p[i] = v.lane[i];
+}
+
+static inline void vst1q_u8(uint8_t *p, uint8x16_t v) {
+	for(int i=0; i<16; i++) p[i] = v.lane[i];
+}
+
+// De-interleave 24 bytes into three vectors, and back
+static inline uint8x8x3_t vld3_u8(const uint8_t *p) {
+	uint8x8x3_t r;
+	for(int i=0; i<8; i++) {
+		for(int j=0; j<3; j++) r.val[j].lane[i] = p[i*3 + j];
+	}
+	return r;
+}
+
+static inline void vst3_u8(uint8_t *p, uint8x8x3_t v) {
+	for(int i=0; i<8; i++) {
+		for(int j=0; j<3; j++) p[i*3 + j] = v.val[j].lane[i];
+	}
+}
+
+static inline uint8x8_t vdup_n_u8(uint8_t x) {
+	uint8x8_t r;
+	for(int i=0; i<8; i++) r.lane[i] = x;
+	return r;
+}
+
+static inline uint8x8_t vshr_n_u8(uint8x8_t v, int n) {
+	for(int i=0; i<8; i++) v.lane[i] >>= n;
+	return v;
+}
+
+static inline uint8x8_t vand_u8(uint8x8_t a, uint8x8_t b) {
+	for(int i=0; i<8; i++) a.lane[i] &= b.lane[i];
+	return a;
+}
+
+// Table lookup: out-of-range indices give 0
+static inline uint8x8_t vtbl1_u8(uint8x8_t table, uint8x8_t index) {
+	uint8x8_t r;
+	for(int i=0; i<8; i++) r.lane[i] = index.lane[i] < 8 ? table.lane[index.lane[i]] : 0;
+	return r;
+}
+
+// Reverse the bytes in each 32-bit word
+static inline uint8x8_t vrev32_u8(uint8x8_t v) {
+	uint8x8_t r;
+	for(int i=0; i<8; i++) r.lane[i] = v.lane[(i & ~3) + 3 - (i & 3)];
+	return r;
+}
+
+static inline uint8x16_t vrev32q_u8(uint8x16_t v) {
+	uint8x16_t r;
+	for(int i=0; i<16; i++) r.lane[i] = v.lane[(i & ~3) + 3 - (i & 3)];
+	return r;
+}
+
+#endif // NEONSHIM_H
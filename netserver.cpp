@@ -0,0 +1,404 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <errno.h>
+
+#include "netserver.h"
+
+// E1.31 packet layout (ANSI E1.31-2018, section 4): root layer, framing layer, DMP layer
+#define E131_ROOT_VECTOR        18
+#define E131_FRAMING_VECTOR     40
+#define E131_SEQUENCE           111
+#define E131_OPTIONS            112
+#define E131_UNIVERSE           113
+#define E131_DMP_VECTOR         117
+#define E131_ADDRESS_TYPE       118
+#define E131_VALUE_COUNT        123
+#define E131_START_CODE         125
+#define E131_DATA               126
+
+#define E131_VECTOR_ROOT_DATA   0x00000004
+#define E131_VECTOR_DATA_PACKET 0x00000002
+#define E131_VECTOR_DMP_SET     0x02
+#define E131_OPTION_PREVIEW     0x80    // For visualizers, not for the stage
+#define E131_OPTION_TERMINATED  0x40    // The source has stopped sending
+
+static const unsigned char e131Identifier[12] = { 'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0, 0, 0 };
+
+static unsigned int readBE16(const unsigned char *p) {
+	return (p[0] << 8) | p[1];
+}
+
+static unsigned int readBE32(const unsigned char *p) {
+	return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+NetServer::NetServer(ws2812b *output, unsigned int leds) {
+	unsigned int i;
+
+	strip = output;
+	numLEDs = leds;
+	stopping = false;
+	pthread_mutex_init(&statsLock, NULL);
+	memset(&stats, 0, sizeof(stats));
+
+	opcListener = -1;
+	for(i=0; i<NET_MAX_CLIENTS; i++) {
+		clients[i].fd = -1;
+		clients[i].buffer = NULL;
+		clients[i].length = 0;
+	}
+
+	e131Socket = -1;
+	firstUniverse = 1;
+	pixelsPerUniverse = E131_PIXELS_PER_UNIVERSE;
+	numUniverses = 0;
+	memset(sequence, 0, sizeof(sequence));
+	memset(seen, 0, sizeof(seen));
+	memset(received, 0, sizeof(received));
+	receivedCount = 0;
+	packets = NULL;
+	messages = NULL;
+	iovecs = NULL;
+}
+
+NetServer::~NetServer() {
+	unsigned int i;
+
+	for(i=0; i<NET_MAX_CLIENTS; i++) {
+		closeOPC(&clients[i]);
+	}
+	if(opcListener >= 0) {
+		close(opcListener);
+	}
+	if(e131Socket >= 0) {
+		close(e131Socket);
+	}
+	free(packets);
+	free(messages);
+	free(iovecs);
+	pthread_mutex_destroy(&statsLock);
+}
+
+// Accept Open Pixel Control connections on port. Returns false if the port can't be opened.
+unsigned char NetServer::listenOPC(unsigned short port) {
+	struct sockaddr_in addr;
+	int one = 1;
+
+	if((opcListener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+		printf("Unable to create the OPC socket\n");
+		return false;
+	}
+	setsockopt(opcListener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if(bind(opcListener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(opcListener, NET_MAX_CLIENTS) != 0) {
+		printf("Unable to listen for OPC on port %d\n", port);
+		close(opcListener);
+		opcListener = -1;
+		return false;
+	}
+	return true;
+}
+
+// Take E1.31 data for universes firstUniverse onwards on port, unicast or multicast. Returns
+// false if the port can't be opened or the strip needs too many universes.
+unsigned char NetServer::listenE131(unsigned short port, unsigned int first, unsigned int perUniverse) {
+	struct sockaddr_in addr;
+	unsigned int i;
+	int size = NET_RCVBUF;
+	unsigned char multicast = true;
+
+	if(perUniverse == 0 || perUniverse > E131_PIXELS_PER_UNIVERSE || first == 0 ||
+	   (numLEDs + perUniverse - 1) / perUniverse > E131_MAX_UNIVERSES ||
+	   first + (numLEDs + perUniverse - 1) / perUniverse - 1 > 63999) {
+		printf("Can't map %d LEDs onto universes %d onwards at %d LEDs each\n", numLEDs, first, perUniverse);
+		return false;
+	}
+	firstUniverse = first;
+	pixelsPerUniverse = perUniverse;
+	numUniverses = (numLEDs + perUniverse - 1) / perUniverse;
+
+	if((e131Socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0)) < 0) {
+		printf("Unable to create the E1.31 socket\n");
+		return false;
+	}
+	setsockopt(e131Socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if(bind(e131Socket, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		printf("Unable to listen for E1.31 on port %d\n", port);
+		close(e131Socket);
+		e131Socket = -1;
+		return false;
+	}
+
+	// Universe u is multicast to 239.255.(u / 256).(u % 256)
+	for(i=0; i<numUniverses && multicast; i++) {
+		struct ip_mreq group;
+		unsigned int universe = firstUniverse + i;
+		group.imr_multiaddr.s_addr = htonl(0xefff0000 | universe);
+		group.imr_interface.s_addr = htonl(INADDR_ANY);
+		if(setsockopt(e131Socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &group, sizeof(group)) != 0) {
+			printf("Unable to join the E1.31 multicast groups, taking unicast only\n");
+			multicast = false;
+		}
+	}
+
+	// Buffers for recvmmsg()
+	packets = (unsigned char (*)[E131_PACKET_MAX])malloc(NET_BATCH * E131_PACKET_MAX);
+	messages = (struct mmsghdr *)calloc(NET_BATCH, sizeof(struct mmsghdr));
+	iovecs = (struct iovec *)calloc(NET_BATCH, sizeof(struct iovec));
+	for(i=0; i<NET_BATCH; i++) {
+		iovecs[i].iov_base = packets[i];
+		iovecs[i].iov_len = E131_PACKET_MAX;
+		messages[i].msg_hdr.msg_iov = &iovecs[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+	}
+	return true;
+}
+
+// Serve until stop() is called
+void NetServer::run() {
+	struct pollfd fds[2 + NET_MAX_CLIENTS];
+	OPCClient_t *polled[NET_MAX_CLIENTS];
+	unsigned int numFds, numPolled, i;
+
+	stopping = false;
+	while(!stopping) {
+		numFds = 0;
+		numPolled = 0;
+		if(opcListener >= 0) {
+			fds[numFds].fd = opcListener;
+			fds[numFds++].events = POLLIN;
+		}
+		if(e131Socket >= 0) {
+			fds[numFds].fd = e131Socket;
+			fds[numFds++].events = POLLIN;
+		}
+		for(i=0; i<NET_MAX_CLIENTS; i++) {
+			if(clients[i].fd >= 0) {
+				polled[numPolled++] = &clients[i];
+				fds[numFds].fd = clients[i].fd;
+				fds[numFds++].events = POLLIN;
+			}
+		}
+
+		if(poll(fds, numFds, NET_POLL_MS) <= 0) {
+			continue;
+		}
+
+		for(i=0; i<numFds; i++) {
+			if(!fds[i].revents) {
+				continue;
+			}
+			if(fds[i].fd == opcListener) {
+				acceptOPC();
+			} else if(fds[i].fd == e131Socket) {
+				readE131();
+			} else {
+				OPCClient_t *client = polled[i - (numFds - numPolled)];
+				if(!readOPC(client)) {
+					closeOPC(client);
+				}
+			}
+		}
+	}
+}
+
+// Make run() return. Safe to call from another thread or a signal handler.
+void NetServer::stop() {
+	stopping = true;
+}
+
+void NetServer::getStats(NetStats_t *out) {
+	pthread_mutex_lock(&statsLock);
+	*out = stats;
+	pthread_mutex_unlock(&statsLock);
+}
+
+void NetServer::showFrame() {
+	strip->show();
+	pthread_mutex_lock(&statsLock);
+	stats.frames++;
+	pthread_mutex_unlock(&statsLock);
+}
+
+void NetServer::countDropped() {
+	pthread_mutex_lock(&statsLock);
+	stats.dropped++;
+	pthread_mutex_unlock(&statsLock);
+}
+
+// Open Pixel Control
+// -------------------------------------------------------------------------------------------------
+
+void NetServer::acceptOPC() {
+	unsigned int i;
+	int fd;
+
+	if((fd = accept4(opcListener, NULL, NULL, SOCK_NONBLOCK)) < 0) {
+		return;
+	}
+	for(i=0; i<NET_MAX_CLIENTS; i++) {
+		if(clients[i].fd < 0) {
+			if(clients[i].buffer == NULL && (clients[i].buffer = (unsigned char *)malloc(4 + 65535)) == NULL) {
+				printf("allocation error \n");
+				close(fd);
+				return;
+			}
+			clients[i].fd = fd;
+			clients[i].length = 0;
+			return;
+		}
+	}
+	printf("Too many OPC connections, refusing another\n");
+	close(fd);
+}
+
+void NetServer::closeOPC(OPCClient_t *client) {
+	if(client->fd >= 0) {
+		close(client->fd);
+		client->fd = -1;
+	}
+	free(client->buffer);
+	client->buffer = NULL;
+	client->length = 0;
+}
+
+// Read whatever the client has sent, handling each message as it completes. Reads stop at the end
+// of a message, so the buffer only ever holds one. Returns false when the connection is done.
+unsigned char NetServer::readOPC(OPCClient_t *client) {
+	unsigned int need;
+	ssize_t got;
+
+	for(;;) {
+		need = client->length < 4 ? 4 : 4 + readBE16(client->buffer + 2);
+		got = read(client->fd, client->buffer + client->length, need - client->length);
+		if(got == 0) {
+			return false;
+		}
+		if(got < 0) {
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+		}
+		client->length += got;
+
+		if(client->length >= 4 && client->length == 4 + readBE16(client->buffer + 2)) {
+			handleOPC(client->buffer, client->length);
+			client->length = 0;
+		}
+	}
+}
+
+// One message: channel, command, 16-bit length, data
+void NetServer::handleOPC(const unsigned char *message, unsigned int length) {
+	unsigned int count = (length - 4) / 3;
+
+	// Command 0 sets pixel colors; the rest (system exclusive) aren't for us
+	if(message[1] != 0 || message[0] > 1) {
+		countDropped();
+		return;
+	}
+	if(count > numLEDs) {
+		count = numLEDs;
+	}
+	if(count > 0) {
+		strip->setPixelsRGB(0, count, message + 4);
+	}
+	pthread_mutex_lock(&statsLock);
+	stats.opcMessages++;
+	pthread_mutex_unlock(&statsLock);
+	showFrame();
+}
+
+// E1.31
+// -------------------------------------------------------------------------------------------------
+
+// Drain the socket, a batch of datagrams per syscall
+void NetServer::readE131() {
+	int got, i;
+
+	do {
+		got = recvmmsg(e131Socket, messages, NET_BATCH, MSG_DONTWAIT, NULL);
+		for(i=0; i<got; i++) {
+			handleE131(packets[i], messages[i].msg_len);
+		}
+	} while(got == NET_BATCH);
+}
+
+void NetServer::handleE131(const unsigned char *packet, unsigned int length) {
+	unsigned int universe, slots, index, first, count;
+	signed char age;
+
+	if(length <= E131_DATA ||
+	   readBE16(packet) != 0x0010 || memcmp(packet + 4, e131Identifier, sizeof(e131Identifier)) != 0 ||
+	   readBE32(packet + E131_ROOT_VECTOR) != E131_VECTOR_ROOT_DATA ||
+	   readBE32(packet + E131_FRAMING_VECTOR) != E131_VECTOR_DATA_PACKET ||
+	   packet[E131_DMP_VECTOR] != E131_VECTOR_DMP_SET || packet[E131_ADDRESS_TYPE] != 0xa1 ||
+	   packet[E131_START_CODE] != 0 ||
+	   (packet[E131_OPTIONS] & (E131_OPTION_PREVIEW | E131_OPTION_TERMINATED))) {
+		countDropped();
+		return;
+	}
+
+	universe = readBE16(packet + E131_UNIVERSE);
+	if(universe < firstUniverse || universe - firstUniverse >= numUniverses) {
+		countDropped();
+		return;
+	}
+	index = universe - firstUniverse;
+
+	// Out of order: anything up to 20 behind the last one is late (E1.31 section 6.7.2)
+	age = (signed char)(packet[E131_SEQUENCE] - sequence[index]);
+	if(seen[index] && age <= 0 && age > -20) {
+		countDropped();
+		return;
+	}
+	sequence[index] = packet[E131_SEQUENCE];
+	seen[index] = true;
+
+	// This universe is already in the frame being collected, so the rest of that frame isn't
+	// coming: show what there is and start the next one
+	if(received[index]) {
+		pthread_mutex_lock(&statsLock);
+		stats.partialFrames++;
+		pthread_mutex_unlock(&statsLock);
+		showFrame();
+		memset(received, 0, sizeof(received));
+		receivedCount = 0;
+	}
+
+	slots = readBE16(packet + E131_VALUE_COUNT) - 1;
+	if(slots > length - E131_DATA) {
+		slots = length - E131_DATA;
+	}
+	first = index * pixelsPerUniverse;
+	count = slots / 3;
+	if(count > pixelsPerUniverse) {
+		count = pixelsPerUniverse;
+	}
+	if(count > numLEDs - first) {
+		count = numLEDs - first;
+	}
+	if(count > 0) {
+		strip->setPixelsRGB(first, count, packet + E131_DATA);
+	}
+
+	pthread_mutex_lock(&statsLock);
+	stats.e131Packets++;
+	pthread_mutex_unlock(&statsLock);
+
+	received[index] = true;
+	if(++receivedCount == numUniverses) {
+		showFrame();
+		memset(received, 0, sizeof(received));
+		receivedCount = 0;
+	}
+}
@@ -0,0 +1,97 @@
+#ifndef NETSERVER_H
+#define NETSERVER_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "ws2812b.h"
+
+// Network frame server
+// -------------------------------------------------------------------------------------------------
+// Takes frames from lighting software over the network and shows them:
+//
+//  - Open Pixel Control over TCP (port 7890 by default). Every "set pixel colors" message on
+//    channel 0 or 1 is a whole frame of packed R, G, B bytes, starting at LED 0.
+//  - E1.31 (streaming ACN) over UDP (port 5568), unicast or multicast. Each universe carries
+//    pixelsPerUniverse LEDs (170 by default: 510 of the 512 DMX slots), so LED n is in universe
+//    firstUniverse + n / pixelsPerUniverse. Universes are collected until every one the strip
+//    spans has arrived, or until one arrives a second time (the rest were lost), and then shown
+//    together as one frame.
+//
+// Datagrams are read in batches with recvmmsg(), and pixel data is copied into the LED buffer a
+// packet at a time with setPixelsRGB(). show() runs once per complete frame; while it does, new
+// packets queue up in the socket buffers.
+
+#define OPC_PORT                7890
+#define E131_PORT               5568
+
+#define NET_BATCH               32      // Datagrams per recvmmsg()
+#define NET_MAX_CLIENTS         4       // OPC connections at once
+#define NET_RCVBUF              (1024 * 1024)   // Socket receive buffer, to ride out a show()
+#define NET_POLL_MS             100     // How often run() checks for stop()
+
+#define E131_PIXELS_PER_UNIVERSE 170
+#define E131_MAX_UNIVERSES      64      // Universes one strip can span
+#define E131_PACKET_MAX         638     // Root + framing + DMP layers and 512 slots
+
+typedef struct NetStats_t {
+	unsigned long frames;           // Frames shown
+	unsigned long opcMessages;      // OPC messages taken
+	unsigned long e131Packets;      // E1.31 data packets taken
+	unsigned long partialFrames;    // E1.31 frames shown with universes missing
+	unsigned long dropped;          // Malformed, out of sequence or not for us
+} NetStats_t;
+
+class NetServer {
+	public:
+		NetServer(ws2812b *output, unsigned int numLEDs);
+		~NetServer();
+
+		unsigned char listenOPC(unsigned short port);
+		unsigned char listenE131(unsigned short port, unsigned int firstUniverse, unsigned int pixelsPerUniverse);
+
+		void run();
+		void stop();
+		void getStats(NetStats_t *stats);
+
+	private:
+		ws2812b *strip;
+		unsigned int numLEDs;
+		volatile unsigned char stopping;
+
+		pthread_mutex_t statsLock;
+		NetStats_t stats;
+
+		// OPC
+		int opcListener;
+		typedef struct OPCClient_t {
+			int fd;
+			unsigned char *buffer;  // One message: 4 byte header and up to 65535 bytes of data
+			unsigned int length;    // Bytes in buffer
+		} OPCClient_t;
+		OPCClient_t clients[NET_MAX_CLIENTS];
+
+		// E1.31
+		int e131Socket;
+		unsigned int firstUniverse;
+		unsigned int pixelsPerUniverse;
+		unsigned int numUniverses;
+		unsigned char sequence[E131_MAX_UNIVERSES];     // Last sequence number per universe
+		unsigned char seen[E131_MAX_UNIVERSES];         // Ever received, so sequence[] means something
+		unsigned char received[E131_MAX_UNIVERSES];     // Received for the frame being collected
+		unsigned int receivedCount;
+		unsigned char (*packets)[E131_PACKET_MAX];
+		struct mmsghdr *messages;
+		struct iovec *iovecs;
+
+		void acceptOPC();
+		unsigned char readOPC(OPCClient_t *client);
+		void closeOPC(OPCClient_t *client);
+		void handleOPC(const unsigned char *message, unsigned int length);
+		void readE131();
+		void handleE131(const unsigned char *packet, unsigned int length);
+		void showFrame();
+		void countDropped();
+};
+
+#endif // NETSERVER_H
@@ -0,0 +1,184 @@
+#include "ws2812b.h"
+#include "mailbox.h"
+
+// The backend every ws2812b in the process shares (see acquire())
+static pthread_mutex_t sharedLock = PTHREAD_MUTEX_INITIALIZER;
+static HardwareBackend *shared = NULL;
+static unsigned int sharedRefs = 0;
+
+// Register blocks, as offsets from peripheralBase()
+static const unsigned int blockOffsets[REG_BLOCKS] = { GPIO_OFFSET, PWM_OFFSET, CLOCK_OFFSET, DMA_OFFSET };
+
+HardwareBackend::HardwareBackend() {
+	int i;
+	for(i=0; i<REG_BLOCKS; i++) {
+		regs[i] = NULL;
+	}
+	mbox = -1;
+	base = 0;
+}
+
+HardwareBackend::~HardwareBackend() {
+	unmap();
+	if(mbox >= 0) {
+		mbox_close(mbox);
+	}
+}
+
+// The process-wide backend, mapped, with one more reference to it. Returns NULL if the registers
+// can't be mapped. Give it back with release().
+HardwareBackend *HardwareBackend::acquire() {
+	HardwareBackend *backend;
+
+	pthread_mutex_lock(&sharedLock);
+	if(shared == NULL) {
+		shared = new HardwareBackend();
+		if(!shared->map()) {
+			delete shared;
+			shared = NULL;
+		}
+	}
+	if(shared != NULL) {
+		sharedRefs++;
+	}
+	backend = shared;
+	pthread_mutex_unlock(&sharedLock);
+	return backend;
+}
+
+// Drop a reference from acquire(). The mappings go with the last one.
+void HardwareBackend::release(HardwareBackend *backend) {
+	pthread_mutex_lock(&sharedLock);
+	if(backend == shared && --sharedRefs == 0) {
+		delete shared;
+		shared = NULL;
+	}
+	pthread_mutex_unlock(&sharedLock);
+}
+
+// Where the peripherals start in physical memory. The device tree's /soc/ranges maps the bus
+// address (first cell) to the physical address, which is the second cell, or on the Pi 4 (with
+// two cells per address) the third. Falls back to PERI_BASE if there's no device tree.
+unsigned int peripheralBase() {
+	unsigned char ranges[12];
+	unsigned int base = 0;
+	size_t got;
+	FILE *f;
+
+	if((f = fopen("/proc/device-tree/soc/ranges", "rb")) != NULL) {
+		got = fread(ranges, 1, sizeof(ranges), f);
+		if(got >= 8) {
+			base = (ranges[4] << 24) | (ranges[5] << 16) | (ranges[6] << 8) | ranges[7];
+		}
+		if(base == 0 && got >= 12) {
+			base = (ranges[8] << 24) | (ranges[9] << 16) | (ranges[10] << 8) | ranges[11];
+		}
+		fclose(f);
+	}
+	return base ? base : PERI_BASE;
+}
+
+// Map 4k register memory for direct access from user space and return a user space pointer to it,
+// or NULL if it can't be mapped.
+// The pointer addresses a 32-bit WORD, not an 8-bit byte. (So, addresses may seem 4x too small!)
+volatile unsigned *HardwareBackend::mapRegisterMemory(int memFd, off_t address) {
+	void *map = mmap(NULL, BLOCK_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, memFd, address);
+	if(map == MAP_FAILED) {
+		printf("Unable to map the registers at 0x%08lx\n", (unsigned long)address);
+		return NULL;
+	}
+
+	// Always use volatile pointer!
+	return (volatile unsigned *)map;
+}
+
+// set up a memory regions to access GPIO, PWM, the clock manager and DMA. /dev/mem is only needed
+// while mapping them. Does nothing if they're mapped already.
+unsigned char HardwareBackend::map() {
+	int memFd, i;
+
+	if(regs[0] != NULL) {
+		return true;
+	}
+
+	if((memFd = open("/dev/mem", O_RDWR|O_SYNC)) < 0) {
+		printf("Unable to open /dev/mem (this needs root)\n");
+		return false;
+	}
+
+	base = peripheralBase();
+	for(i=0; i<REG_BLOCKS; i++) {
+		if((regs[i] = mapRegisterMemory(memFd, (off_t)base + blockOffsets[i])) == NULL) {
+			close(memFd);
+			unmap();
+			return false;
+		}
+	}
+	close(memFd);
+	return true;
+}
+
+void HardwareBackend::unmap() {
+	int i;
+	for(i=0; i<REG_BLOCKS; i++) {
+		if(regs[i] != NULL) {
+			munmap((void *)regs[i], BLOCK_SIZE);
+			regs[i] = NULL;
+		}
+	}
+}
+
+unsigned int HardwareBackend::read(int block, unsigned int reg) {
+	return *(regs[block] + reg);
+}
+
+void HardwareBackend::write(int block, unsigned int reg, unsigned int value) {
+	*(regs[block] + reg) = value;
+}
+
+// Allocate uncached, physically contiguous memory from the GPU through the mailbox and map it
+unsigned char HardwareBackend::allocDMAMemory(unsigned int size, DMAMemory_t *mem) {
+	memset(mem, 0, sizeof(DMAMemory_t));
+	mem->size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+	if(mbox < 0 && (mbox = mbox_open()) < 0) {
+		return false;
+	}
+
+	mem->handle = mem_alloc(mbox, mem->size, PAGE_SIZE, MEM_FLAG_DIRECT | MEM_FLAG_ZERO);
+	if(mem->handle == 0) {
+		printf("Unable to allocate %d bytes of DMA memory\n", mem->size);
+		return false;
+	}
+
+	mem->bus = mem_lock(mbox, mem->handle);
+	if(mem->bus != 0) {
+		mem->virt = mapmem(BUS_TO_PHYS(mem->bus), mem->size);
+	}
+	if(mem->virt == NULL) {
+		printf("Unable to map DMA memory\n");
+		freeDMAMemory(mem);
+		return false;
+	}
+	return true;
+}
+
+void HardwareBackend::freeDMAMemory(DMAMemory_t *mem) {
+	if(mem->virt != NULL) {
+		unmapmem(mem->virt, mem->size);
+	}
+	if(mem->handle) {
+		mem_unlock(mbox, mem->handle);
+		mem_free(mbox, mem->handle);
+	}
+	memset(mem, 0, sizeof(DMAMemory_t));
+}
+
+double HardwareBackend::clockSourceHz(unsigned int source) {
+	unsigned char pi4 = (base ? base : peripheralBase()) == PERI_BASE_PI4;
+	switch(source) {
+		case CLK_SRC_OSC: return pi4 ? OSC_HZ_PI4 : OSC_HZ;
+		case CLK_SRC_PLLD: return pi4 ? PLLD_HZ_PI4 : PLLD_HZ;
+		default: return 0;
+	}
+}
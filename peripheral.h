@@ -0,0 +1,92 @@
+#ifndef PERIPHERAL_H
+#define PERIPHERAL_H
+
+// Register backends
+// -------------------------------------------------------------------------------------------------
+// ws2812b never touches the peripheral registers directly. Every read and write goes through a
+// RegisterBackend, which either maps the real registers out of /dev/mem (HardwareBackend) or
+// models them in software (SimulatedBackend, see simulator.h), so the same code can run on a Pi
+// or on an ordinary Linux machine.
+//
+// Registers are addressed by block and *word* offset within the block, i.e. the same offsets as
+// the PWM_*, DMA_* and PWM_CLK_* defines in ws2812b.h.
+
+// Register blocks
+#define REG_GPIO 0
+#define REG_PWM  1
+#define REG_CLK  2
+#define REG_DMA  3
+#define REG_BLOCKS 4
+
+// Clock manager sources the PWM clock can run from, and their nominal frequencies. The Pi 4 runs
+// them faster. PLLC also drives the core clock, which changes with load, so it's not used.
+#define CLK_SRC_OSC     1
+#define CLK_SRC_PLLC    5
+#define CLK_SRC_PLLD    6
+
+#define OSC_HZ          19200000.0
+#define PLLC_HZ         1000000000.0
+#define PLLD_HZ         500000000.0
+#define OSC_HZ_PI4      54000000.0
+#define PLLD_HZ_PI4     750000000.0
+
+// Where the peripherals start on the Pi 4
+#define PERI_BASE_PI4   0xFE000000
+
+// A block of memory the DMA controller can read, with its address on both sides
+typedef struct DMAMemory_t {
+	void *virt;                     // Where we see it
+	unsigned int bus;               // Where the DMA controller sees it
+	unsigned int size;              // In bytes
+	unsigned int handle;            // Backend-specific
+} DMAMemory_t;
+
+class RegisterBackend {
+	public:
+		virtual ~RegisterBackend() {}
+
+		// Get access to the registers. Returns false if that isn't possible.
+		virtual unsigned char map() = 0;
+
+		virtual unsigned int read(int block, unsigned int reg) = 0;
+		virtual void write(int block, unsigned int reg, unsigned int value) = 0;
+
+		// Physically contiguous memory for DMA. Returns false if none is available.
+		virtual unsigned char allocDMAMemory(unsigned int size, DMAMemory_t *mem) = 0;
+		virtual void freeDMAMemory(DMAMemory_t *mem) = 0;
+
+		// Frequency of clock source (CLK_SRC_*), 0 if it's not usable
+		virtual double clockSourceHz(unsigned int source) = 0;
+};
+
+// The real thing: registers mapped from /dev/mem, DMA memory from the VideoCore mailbox.
+// ws2812b objects share one, through acquire() and release(), so however many there are the
+// registers are only mapped once.
+class HardwareBackend : public RegisterBackend {
+	public:
+		HardwareBackend();
+		~HardwareBackend();
+
+		static HardwareBackend *acquire();
+		static void release(HardwareBackend *backend);
+
+		unsigned char map();
+		unsigned int read(int block, unsigned int reg);
+		void write(int block, unsigned int reg, unsigned int value);
+		unsigned char allocDMAMemory(unsigned int size, DMAMemory_t *mem);
+		void freeDMAMemory(DMAMemory_t *mem);
+		double clockSourceHz(unsigned int source);
+
+	private:
+		volatile unsigned *regs[REG_BLOCKS];
+		unsigned int base;              // peripheralBase(), which also tells the Pi 4 apart
+		int mbox;                       // Mailbox file descriptor
+
+		volatile unsigned *mapRegisterMemory(int memFd, off_t address);
+		void unmap();
+};
+
+// Physical address of the peripherals on this Pi
+unsigned int peripheralBase();
+
+#endif // PERIPHERAL_H
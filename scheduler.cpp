@@ -0,0 +1,134 @@
+#include "scheduler.h"
+
+FrameScheduler::FrameScheduler(ws2812b *output, double fps) {
+	strip = output;
+	periodNs = (unsigned long long)(1000000000.0 / fps + 0.5);
+	stopping = false;
+	pthread_mutex_init(&statsLock, NULL);
+	memset(&stats, 0, sizeof(stats));
+	startNs = 0;
+}
+
+FrameScheduler::~FrameScheduler() {
+	pthread_mutex_destroy(&statsLock);
+}
+
+// Run the calling thread (which should be the one calling run()) and the strip's output thread
+// with SCHED_FIFO priority, each pinned to a CPU (-1: any). Needs root or CAP_SYS_NICE.
+unsigned char FrameScheduler::setRealtime(int priority, int schedulerCPU, int outputCPU) {
+	unsigned char ok = setThreadPolicy(pthread_self(), priority, schedulerCPU);
+	if(!strip->setOutputThreadPolicy(priority, outputCPU)) {
+		ok = false;
+	}
+	return ok;
+}
+
+// Lock all current and future memory, so a page fault can't stall a frame
+unsigned char FrameScheduler::lockMemory() {
+	if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+		printf("Unable to lock memory\n");
+		return false;
+	}
+	return true;
+}
+
+// Render and send frames until render() returns false, stop() is called, or frames frames have
+// been sent (0: no limit)
+void FrameScheduler::run(RenderCallback_t render, void *arg, unsigned long frames) {
+	unsigned long frame;
+	unsigned long long deadline, now;
+
+	pthread_mutex_lock(&statsLock);
+	memset(&stats, 0, sizeof(stats));
+	startNs = monotonicNs();
+	pthread_mutex_unlock(&statsLock);
+
+	stopping = false;
+	deadline = startNs;
+	for(frame=0; !stopping && (frames == 0 || frame < frames); frame++) {
+		if(!render(arg, frame, strip)) {
+			break;
+		}
+
+		now = monotonicNs();
+		if(now > deadline) {
+			// Too late for this slot: send now and line up with the next slot still ahead
+			unsigned long long behind = (now - deadline) / periodNs;
+			pthread_mutex_lock(&statsLock);
+			stats.missed++;
+			stats.skipped += behind;
+			pthread_mutex_unlock(&statsLock);
+			deadline += behind * periodNs;
+		} else {
+			sleepUntilNs(deadline);
+			recordLatency(monotonicNs() - deadline);
+		}
+
+		strip->showAsync();
+		deadline += periodNs;
+
+		pthread_mutex_lock(&statsLock);
+		stats.frames++;
+		pthread_mutex_unlock(&statsLock);
+	}
+	strip->waitForFrame();
+}
+
+// Make run() return after the frame it's working on. Safe to call from another thread.
+void FrameScheduler::stop() {
+	stopping = true;
+}
+
+void FrameScheduler::recordLatency(unsigned long long latencyNs) {
+	unsigned long long us = latencyNs / 1000;
+	unsigned int bucket = 0;
+
+	while(us > 0 && bucket < SCHED_HISTOGRAM_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+
+	pthread_mutex_lock(&statsLock);
+	stats.histogram[bucket]++;
+	stats.totalLatencyNs += latencyNs;
+	if(latencyNs > stats.maxLatencyNs) {
+		stats.maxLatencyNs = latencyNs;
+	}
+	pthread_mutex_unlock(&statsLock);
+}
+
+// Snapshot of the statistics. Safe to call while run() is going.
+void FrameScheduler::getStats(SchedulerStats_t *out) {
+	unsigned long long elapsed;
+
+	pthread_mutex_lock(&statsLock);
+	*out = stats;
+	elapsed = startNs ? monotonicNs() - startNs : 0;
+	pthread_mutex_unlock(&statsLock);
+	out->fps = elapsed ? out->frames * 1e9 / elapsed : 0;
+}
+
+void FrameScheduler::printStats() {
+	SchedulerStats_t s;
+	unsigned long onTime;
+	int i;
+
+	getStats(&s);
+	onTime = s.frames - s.missed;
+	printf("Frames: %lu (%.2f fps, target %.2f)\n", s.frames, s.fps, 1e9 / periodNs);
+	printf("Missed deadlines: %lu (%lu slots skipped)\n", s.missed, s.skipped);
+	printf("Wake-up latency: mean %llu us, max %llu us\n",
+	       onTime ? s.totalLatencyNs / onTime / 1000 : 0, s.maxLatencyNs / 1000);
+	for(i=0; i<SCHED_HISTOGRAM_BUCKETS; i++) {
+		if(s.histogram[i] == 0) {
+			continue;
+		}
+		if(i == 0) {
+			printf("    < 1 us: %lu\n", s.histogram[i]);
+		} else if(i == SCHED_HISTOGRAM_BUCKETS - 1) {
+			printf("    >= %d us: %lu\n", 1 << (i - 1), s.histogram[i]);
+		} else {
+			printf("    %d-%d us: %lu\n", 1 << (i - 1), (1 << i) - 1, s.histogram[i]);
+		}
+	}
+}
@@ -0,0 +1,62 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "ws2812b.h"
+
+// Frame scheduler
+// -------------------------------------------------------------------------------------------------
+// Runs a render callback at a fixed frame rate and hands each frame to showAsync() on an absolute
+// deadline: frame n goes out at start + n * period on the monotonic clock, so sleeping late once
+// doesn't push every later frame back. The callback for frame n+1 runs while frame n is on the
+// wire, and the scheduler then sleeps until frame n+1's deadline.
+//
+// If a frame is rendered after its deadline it's sent straight away and counted as missed, and
+// the schedule skips ahead to the next deadline still in the future, so the show stays in phase.
+//
+// For steady intervals under load, give the scheduling thread and the output thread real-time
+// priority (setRealtime()), keep everything in RAM (lockMemory()) and pin the two threads to a CPU
+// of their own. Lateness of every wake-up goes into a histogram (see getStats()).
+
+// Histogram buckets: bucket 0 is under 1 us late, bucket i is 2^(i-1) to 2^i us, the last one
+// everything later
+#define SCHED_HISTOGRAM_BUCKETS 16
+
+typedef struct SchedulerStats_t {
+	unsigned long frames;           // Frames sent
+	unsigned long missed;           // Frames rendered after their deadline
+	unsigned long skipped;          // Deadlines skipped to catch up
+	double fps;                     // Achieved frame rate since run() started
+	unsigned long long maxLatencyNs;        // Latest wake-up after a deadline
+	unsigned long long totalLatencyNs;      // Sum over all frames, for the mean
+	unsigned long histogram[SCHED_HISTOGRAM_BUCKETS];
+} SchedulerStats_t;
+
+// Fills in the strip for frame n. Return false to stop the scheduler.
+typedef unsigned char (*RenderCallback_t)(void *arg, unsigned long frame, ws2812b *strip);
+
+class FrameScheduler {
+	public:
+		FrameScheduler(ws2812b *output, double fps);
+		~FrameScheduler();
+
+		unsigned char setRealtime(int priority, int schedulerCPU, int outputCPU);
+		unsigned char lockMemory();
+
+		void run(RenderCallback_t render, void *arg, unsigned long frames);
+		void stop();
+		void getStats(SchedulerStats_t *stats);
+		void printStats();
+
+	private:
+		ws2812b *strip;
+		unsigned long long periodNs;
+		volatile unsigned char stopping;
+
+		pthread_mutex_t statsLock;
+		SchedulerStats_t stats;
+		unsigned long long startNs;
+
+		void recordLatency(unsigned long long latencyNs);
+};
+
+#endif // SCHEDULER_H
@@ -0,0 +1,150 @@
+#include "segments.h"
+
+// The buffer to draw the segment's next frame into. Pixel 0 is the segment's first LED. It holds
+// the last frame published, so only what changes needs drawing.
+Color_t *segmentPixels(Segment_t *segment) {
+	return segment->buffers[segment->back];
+}
+
+unsigned char setSegmentPixel(Segment_t *segment, unsigned int pixel, unsigned char r, unsigned char g, unsigned char b) {
+	if(pixel >= segment->count) {
+		printf("Unable to set pixel %d of segment %s (only has %d)\n", pixel, segment->name, segment->count);
+		return false;
+	}
+	Color_t *out = segment->buffers[segment->back] + pixel;
+	out->r = r;
+	out->g = g;
+	out->b = b;
+	return true;
+}
+
+// Hand the back buffer to the show side. The buffer that comes back in exchange is brought up to
+// date with the one just published, so the writer carries on from where it left off.
+void publishSegment(Segment_t *segment) {
+	unsigned int done = segment->back;
+	unsigned int old = __atomic_exchange_n(&segment->state, done | SEGMENT_FRESH, __ATOMIC_ACQ_REL);
+	segment->back = old & 3;
+	segment->published++;
+
+	// The show side only ever reads a buffer, so reading the published one alongside it is safe
+	memcpy(segment->buffers[segment->back], segment->buffers[done], segment->count * sizeof(Color_t));
+}
+
+SegmentedStrip::SegmentedStrip(ws2812b *output, unsigned int leds) {
+	strip = output;
+	numLEDs = leds;
+	numSegments = 0;
+}
+
+SegmentedStrip::~SegmentedStrip() {
+	unsigned int i;
+	for(i=0; i<numSegments; i++) {
+		free(segments[i]->buffers[0]);
+		free(segments[i]);
+	}
+}
+
+// Set aside LEDs first to first+count-1 as a segment called name, all black to start with.
+// Segments can't overlap. Returns NULL if it can't be added.
+Segment_t *SegmentedStrip::addSegment(const char *name, unsigned int first, unsigned int count) {
+	Segment_t *segment;
+	void *block, *pixels;
+	unsigned int i, stride;
+
+	if(numSegments == SEGMENT_MAX) {
+		printf("Unable to add segment %s (only %d allowed)\n", name, SEGMENT_MAX);
+		return NULL;
+	}
+	if(strlen(name) >= SEGMENT_NAME_LENGTH || findSegment(name) != NULL) {
+		printf("Segment name %s is too long or already taken\n", name);
+		return NULL;
+	}
+	if(count == 0 || first > numLEDs || count > numLEDs - first) {
+		printf("Unable to make LEDs %d-%d a segment (don't have that many LEDs!)\n", first, first + count - 1);
+		return NULL;
+	}
+	for(i=0; i<numSegments; i++) {
+		if(first < segments[i]->first + segments[i]->count && segments[i]->first < first + count) {
+			printf("Segment %s overlaps segment %s\n", name, segments[i]->name);
+			return NULL;
+		}
+	}
+
+	// One block for the three buffers, each starting on a cache line
+	stride = (count * sizeof(Color_t) + LED_BUFFER_ALIGN - 1) / LED_BUFFER_ALIGN * LED_BUFFER_ALIGN;
+	if(posix_memalign(&block, LED_BUFFER_ALIGN, sizeof(Segment_t)) != 0) {
+		printf("allocation error \n");
+		return NULL;
+	}
+	if(posix_memalign(&pixels, LED_BUFFER_ALIGN, 3 * stride) != 0) {
+		printf("allocation error \n");
+		free(block);
+		return NULL;
+	}
+	memset(block, 0, sizeof(Segment_t));
+	memset(pixels, 0, 3 * stride);
+
+	segment = (Segment_t *)block;
+	strcpy(segment->name, name);
+	segment->first = first;
+	segment->count = count;
+	for(i=0; i<3; i++) {
+		segment->buffers[i] = (Color_t *)((unsigned char *)pixels + i * stride);
+	}
+	segment->back = 0;
+	segment->state = 1;
+	segment->front = 2;
+
+	segments[numSegments++] = segment;
+	return segment;
+}
+
+Segment_t *SegmentedStrip::findSegment(const char *name) {
+	unsigned int i;
+	for(i=0; i<numSegments; i++) {
+		if(strcmp(segments[i]->name, name) == 0) {
+			return segments[i];
+		}
+	}
+	return NULL;
+}
+
+// Copy the newest published frame of every segment into the LED buffer. Only segments that differ
+// from what the LED buffer holds are marked changed, so show() re-encodes just those (after
+// showAsync() the LED buffer is an older frame, which this catches up too). Returns true if
+// anything changed.
+unsigned char SegmentedStrip::assemble() {
+	Color_t *pixels = strip->pixelBuffer();
+	unsigned char changed = false;
+	unsigned int i;
+
+	for(i=0; i<numSegments; i++) {
+		Segment_t *segment = segments[i];
+
+		if(__atomic_load_n(&segment->state, __ATOMIC_RELAXED) & SEGMENT_FRESH) {
+			unsigned int old = __atomic_exchange_n(&segment->state, segment->front, __ATOMIC_ACQ_REL);
+			segment->front = old & 3;
+			segment->taken++;
+		}
+
+		const Color_t *latest = segment->buffers[segment->front];
+		if(memcmp(pixels + segment->first, latest, segment->count * sizeof(Color_t)) != 0) {
+			memcpy(pixels + segment->first, latest, segment->count * sizeof(Color_t));
+			strip->pixelsChanged(segment->first, segment->count);
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+// Assemble a frame from the segments and send it
+void SegmentedStrip::show() {
+	assemble();
+	strip->show();
+}
+
+// Assemble a frame from the segments and queue it with showAsync()
+unsigned long SegmentedStrip::showAsync() {
+	assemble();
+	return strip->showAsync();
+}
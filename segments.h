@@ -0,0 +1,79 @@
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+
+#include "ws2812b.h"
+
+// Segmented strips
+// -------------------------------------------------------------------------------------------------
+// Splits one chain into named segments, each a run of LEDs that one writer thread owns. A writer
+// draws into its segment's back buffer (segmentPixels()) and publishes it (publishSegment()); the
+// thread that shows frames takes the newest published state of every segment and copies it into
+// the LED buffer in one pass. No segment waits on another, and nobody takes a lock.
+//
+// Each segment is a triple buffer. The writer owns one buffer (back), the show side owns another
+// (front), and the third (middle) holds the latest published frame. Publishing atomically swaps
+// back with middle and flags middle as fresh; taking a frame swaps front with middle if it's
+// fresh. A writer can publish as often as it likes without ever waiting, the show side always
+// gets a whole frame, and frames published in between are simply skipped. The writer's fields,
+// the swap word and the show side's fields each get a cache line, so writers on different cores
+// don't slow each other or the show side down.
+//
+// Segments are added before the writers start and live as long as the SegmentedStrip. Only one
+// thread calls show(), showAsync() or assemble().
+//
+//   SegmentedStrip zones(strip, numLEDs);
+//   Segment_t *ceiling = zones.addSegment("ceiling", 0, 300);
+//   // On the ceiling's thread:
+//   Color_t *pixels = segmentPixels(ceiling);
+//   ...
+//   publishSegment(ceiling);
+//   // On the show thread:
+//   zones.showAsync();
+
+#define SEGMENT_MAX             16
+#define SEGMENT_NAME_LENGTH     32
+#define SEGMENT_FRESH           4       // In Segment_t::state: middle holds an unseen frame
+
+typedef struct Segment_t {
+	char name[SEGMENT_NAME_LENGTH];
+	unsigned int first;             // LEDs first to first+count-1 of the chain
+	unsigned int count;
+	Color_t *buffers[3];
+
+	// Writer side
+	unsigned int back __attribute__((aligned(64)));
+	unsigned long published;        // Frames published
+
+	// Index of the middle buffer, and SEGMENT_FRESH
+	unsigned int state __attribute__((aligned(64)));
+
+	// Show side
+	unsigned int front __attribute__((aligned(64)));
+	unsigned long taken;            // Published frames that made it into a frame
+} Segment_t;
+
+// Writer side
+Color_t *segmentPixels(Segment_t *segment);
+unsigned char setSegmentPixel(Segment_t *segment, unsigned int pixel, unsigned char r, unsigned char g, unsigned char b);
+void publishSegment(Segment_t *segment);
+
+class SegmentedStrip {
+	public:
+		SegmentedStrip(ws2812b *output, unsigned int leds);
+		~SegmentedStrip();
+
+		Segment_t *addSegment(const char *name, unsigned int first, unsigned int count);
+		Segment_t *findSegment(const char *name);
+
+		unsigned char assemble();
+		void show();
+		unsigned long showAsync();
+
+	private:
+		ws2812b *strip;
+		unsigned int numLEDs;
+		Segment_t *segments[SEGMENT_MAX];
+		unsigned int numSegments;
+};
+
+#endif // SEGMENTS_H
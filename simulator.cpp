@@ -0,0 +1,641 @@
+#include "simulator.h"
+
+SimulatedBackend::SimulatedBackend() {
+	pthread_mutex_init(&lock, NULL);
+	epochNs = monotonicNs();
+	modelNs = 0;
+
+	memset(regs, 0, sizeof(regs));
+	memset(fifo, 0, sizeof(fifo));
+	fifoHead = fifoCount = 0;
+	shifting = 0;
+	starved = false;
+	memset(current, 0, sizeof(current));
+	wordEndNs = 0;
+	frameWords = 0;
+	fault = 0;
+	faultFrame = 0;
+	faultWord = 0;
+	memset(channels, 0, sizeof(channels));
+	nextBus = 0xC0001000;           // Uncached alias, like mailbox memory
+
+	recording = true;
+	memset(&stats, 0, sizeof(stats));
+	t0hMaxNs = SIM_T0H_MAX_NS;
+	t1hMaxNs = SIM_T1H_MAX_NS;
+}
+
+SimulatedBackend::~SimulatedBackend() {
+	unsigned int i;
+	for(i=0; i<allocations.size(); i++) {
+		free(allocations[i].mem);
+	}
+	pthread_mutex_destroy(&lock);
+}
+
+unsigned char SimulatedBackend::map() {
+	return true;
+}
+
+unsigned long long SimulatedBackend::nowNs() {
+	return monotonicNs() - epochNs;
+}
+
+unsigned int SimulatedBackend::read(int block, unsigned int reg) {
+	unsigned int value;
+
+	pthread_mutex_lock(&lock);
+	advance(nowNs());
+	switch(block) {
+		case REG_PWM:
+			value = readPWM(reg);
+			break;
+		case REG_CLK:
+			value = readCLK(reg);
+			break;
+		case REG_DMA:
+			value = readDMA(reg);
+			break;
+		default:
+			value = regs[block][reg];
+			break;
+	}
+	pthread_mutex_unlock(&lock);
+	return value;
+}
+
+void SimulatedBackend::write(int block, unsigned int reg, unsigned int value) {
+	unsigned long long now;
+
+	pthread_mutex_lock(&lock);
+	now = nowNs();
+	advance(now);
+	switch(block) {
+		case REG_PWM:
+			writePWM(reg, value);
+			break;
+		case REG_CLK:
+			writeCLK(reg, value);
+			break;
+		case REG_DMA:
+			writeDMA(reg, value);
+			break;
+		default:
+			regs[block][reg] = value;
+			break;
+	}
+	// The write may have started something (PWEN1, a FIFO word, a DMA chain)
+	advance(now);
+	pthread_mutex_unlock(&lock);
+}
+
+// Hand out zeroed memory with a made-up bus address the DMA model can translate back
+unsigned char SimulatedBackend::allocDMAMemory(unsigned int size, DMAMemory_t *mem) {
+	SimAllocation_t allocation;
+
+	memset(mem, 0, sizeof(DMAMemory_t));
+	size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	if((allocation.mem = (unsigned char *)calloc(1, size)) == NULL) {
+		return false;
+	}
+
+	pthread_mutex_lock(&lock);
+	allocation.bus = nextBus;
+	allocation.size = size;
+	nextBus += size;
+	allocations.push_back(allocation);
+	pthread_mutex_unlock(&lock);
+
+	mem->virt = allocation.mem;
+	mem->bus = allocation.bus;
+	mem->size = size;
+	return true;
+}
+
+void SimulatedBackend::freeDMAMemory(DMAMemory_t *mem) {
+	unsigned int i;
+
+	pthread_mutex_lock(&lock);
+	for(i=0; i<allocations.size(); i++) {
+		if(allocations[i].mem == mem->virt) {
+			free(allocations[i].mem);
+			allocations.erase(allocations.begin() + i);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	memset(mem, 0, sizeof(DMAMemory_t));
+}
+
+void *SimulatedBackend::busToVirt(unsigned int bus, unsigned int size) {
+	unsigned int i;
+	for(i=0; i<allocations.size(); i++) {
+		if(bus >= allocations[i].bus && bus + size <= allocations[i].bus + allocations[i].size) {
+			return allocations[i].mem + (bus - allocations[i].bus);
+		}
+	}
+	return NULL;
+}
+
+// Clock manager
+// -------------------------------------------------------------------------------------------------
+
+// Length of one serializer bit with the current clock setup, 0 if the clock isn't running
+double SimulatedBackend::bitPeriodNs() {
+	unsigned int cntl = regs[REG_CLK][PWM_CLK_CNTL];
+	unsigned int div = regs[REG_CLK][PWM_CLK_DIV];
+	double hz, divisor;
+
+	if(!(cntl & (1 << CM_CNTL_ENAB))) {
+		return 0;
+	}
+	switch((cntl >> CM_CNTL_SRC) & 0xF) {
+		case CLK_SRC_OSC: hz = SIM_OSC_HZ; break;
+		case CLK_SRC_PLLC: hz = SIM_PLLC_HZ; break;
+		case CLK_SRC_PLLD: hz = SIM_PLLD_HZ; break;
+		default: return 0;
+	}
+
+	divisor = (div >> 12) & 0xFFF;
+	if((cntl >> CM_CNTL_MASH) & 3) {
+		divisor += (div & 0xFFF) / 4096.0;     // MASH on: the fractional part counts
+	}
+	if(divisor < 1) {
+		return 0;
+	}
+	return divisor * 1e9 / hz;
+}
+
+double SimulatedBackend::clockSourceHz(unsigned int source) {
+	switch(source) {
+		case CLK_SRC_OSC: return SIM_OSC_HZ;
+		case CLK_SRC_PLLC: return SIM_PLLC_HZ;
+		case CLK_SRC_PLLD: return SIM_PLLD_HZ;
+		default: return 0;
+	}
+}
+
+unsigned int SimulatedBackend::readCLK(unsigned int reg) {
+	unsigned int value = regs[REG_CLK][reg];
+	if(reg == PWM_CLK_CNTL && bitPeriodNs() > 0) {
+		value |= (1 << CM_CNTL_BUSY);
+	}
+	return value;
+}
+
+void SimulatedBackend::writeCLK(unsigned int reg, unsigned int value) {
+	// Writes without the password are ignored
+	if((value & 0xFF000000) != CM_PASSWD) {
+		return;
+	}
+	value &= 0x00FFFFFF;
+	if(reg == PWM_CLK_CNTL) {
+		value &= ~(1 << CM_CNTL_BUSY);
+		if(value & (1 << CM_CNTL_KILL)) {
+			value &= ~((1 << CM_CNTL_KILL) | (1 << CM_CNTL_ENAB));
+		}
+	}
+	regs[REG_CLK][reg] = value;
+}
+
+// PWM
+// -------------------------------------------------------------------------------------------------
+
+// Channels (bit 0: channel 1, bit 1: channel 2) enabled in serializer mode from the FIFO
+unsigned int SimulatedBackend::runningChannels() {
+	unsigned int ctl = regs[REG_PWM][PWM_CTL];
+	unsigned int channels = 0;
+
+	if(bitPeriodNs() <= 0) {
+		return 0;
+	}
+	if((ctl & (1 << PWM_CTL_PWEN1)) && (ctl & (1 << PWM_CTL_MODE1)) && (ctl & (1 << PWM_CTL_USEF1))) {
+		channels |= 1;
+	}
+	if((ctl & (1 << PWM_CTL_PWEN2)) && (ctl & (1 << PWM_CTL_MODE2)) && (ctl & (1 << PWM_CTL_USEF2))) {
+		channels |= 2;
+	}
+	return channels;
+}
+
+// Take the next word for each running channel out of the FIFO and start shifting them at time t.
+// With both channels running the FIFO alternates between them, channel 1 first; the model keeps
+// the two in step, one word each per word period.
+void SimulatedBackend::startWord(unsigned long long t, unsigned int channels) {
+	unsigned int ch, range;
+
+	if(starved) {
+		// There was a hole in the data: that's a gap, and the LEDs see a stretched low time
+		if(channels & 1) regs[REG_PWM][PWM_STA] |= (1 << PWM_STA_GAPO1);
+		if(channels & 2) regs[REG_PWM][PWM_STA] |= (1 << PWM_STA_GAPO2);
+		stats.gaps++;
+		starved = false;
+	}
+
+	// A forced gap: the FIFO looks empty for a while before this word
+	unsigned char faulting = fault && stats.framesStarted == faultFrame + 1 && frameWords == faultWord;
+	if(faulting && fault == SIM_FAULT_GAP) {
+		if(channels & 1) regs[REG_PWM][PWM_STA] |= (1 << PWM_STA_GAPO1);
+		if(channels & 2) regs[REG_PWM][PWM_STA] |= (1 << PWM_STA_GAPO2);
+		stats.gaps++;
+		t += SIM_FAULT_GAP_NS;
+	}
+
+	wordEndNs = t;
+	for(ch=0; ch<2; ch++) {
+		if(!(channels & (1 << ch))) {
+			continue;
+		}
+		range = regs[REG_PWM][ch == 0 ? PWM_RNG1 : PWM_RNG2];
+		current[ch].word = fifo[fifoHead];
+		current[ch].bits = range ? range : 32;
+		current[ch].channel = ch + 1;
+		current[ch].startNs = t;
+		current[ch].bitNs = bitPeriodNs();
+		fifoHead = (fifoHead + 1) % PWM_FIFO_LENGTH;
+		fifoCount--;
+		if(faulting && fault == SIM_FAULT_READ) {
+			// The word read is lost, and the serializer shifts out zeros in its place
+			current[ch].word = 0;
+			regs[REG_PWM][PWM_STA] |= (1 << PWM_STA_RERR1);
+		}
+
+		unsigned long long end = t + (unsigned long long)(current[ch].bits * current[ch].bitNs + 0.5);
+		if(end > wordEndNs) {
+			wordEndNs = end;
+		}
+	}
+	shifting = channels;
+	frameWords++;
+	if(faulting) {
+		stats.faults++;
+		fault = 0;
+	}
+}
+
+// Run the model forward to now: finish words, let the DMA refill the FIFO, start the next words
+void SimulatedBackend::advance(unsigned long long now) {
+	unsigned long long t = modelNs;
+	unsigned int channels, ch;
+
+	for(;;) {
+		serviceDMA();
+		channels = runningChannels();
+		if(!shifting && channels && fifoCount >= (channels == 3 ? 2u : 1u)) {
+			startWord(t, channels);
+		}
+		if(shifting && wordEndNs <= now) {
+			t = wordEndNs;
+			for(ch=0; ch<2; ch++) {
+				if(shifting & (1 << ch)) {
+					stats.wordsShifted++;
+					if(recording) {
+						wire.push_back(current[ch]);
+					}
+				}
+			}
+			shifting = 0;
+			serviceDMA();
+			channels = runningChannels();
+			if(fifoCount < (channels == 3 ? 2u : 1u)) {
+				starved = true;
+			}
+			continue;
+		}
+		break;
+	}
+	if(now > modelNs) {
+		modelNs = now;
+	}
+}
+
+unsigned int SimulatedBackend::readPWM(unsigned int reg) {
+	unsigned int value;
+
+	switch(reg) {
+		case PWM_STA:
+			value = regs[REG_PWM][PWM_STA] & ((1 << PWM_STA_GAPO1) | (1 << PWM_STA_GAPO2) |
+			                                  (1 << PWM_STA_RERR1) | (1 << PWM_STA_WERR1) |
+			                                  (1 << PWM_STA_BERR));
+			if(fifoCount == PWM_FIFO_LENGTH) value |= (1 << PWM_STA_FULL1);
+			if(fifoCount == 0) value |= (1 << PWM_STA_EMPT1);
+			if(shifting & 1) value |= (1 << PWM_STA_STA1);
+			if(shifting & 2) value |= (1 << PWM_STA_STA2);
+			return value;
+		case PWM_FIF1:
+			return 0;
+		default:
+			return regs[REG_PWM][reg];
+	}
+}
+
+void SimulatedBackend::writePWM(unsigned int reg, unsigned int value) {
+	switch(reg) {
+		case PWM_CTL:
+			if(value & (1 << PWM_CTL_CLRF1)) {
+				fifoHead = fifoCount = 0;
+				value &= ~(1 << PWM_CTL_CLRF1);
+			}
+			if(((shifting & 1) && !(value & (1 << PWM_CTL_PWEN1))) ||
+			   ((shifting & 2) && !(value & (1 << PWM_CTL_PWEN2)))) {
+				// Disabling a channel cuts off whatever it was sending
+				stats.abortedWords++;
+				shifting = 0;
+			}
+			if(!(value & ((1 << PWM_CTL_PWEN1) | (1 << PWM_CTL_PWEN2)))) {
+				starved = false;
+			} else if(!(regs[REG_PWM][PWM_CTL] & ((1 << PWM_CTL_PWEN1) | (1 << PWM_CTL_PWEN2)))) {
+				// Enabled from idle: a new frame
+				stats.framesStarted++;
+				frameWords = 0;
+			}
+			regs[REG_PWM][PWM_CTL] = value;
+			break;
+		case PWM_STA:
+			// Error bits are cleared by writing 1 to them
+			regs[REG_PWM][PWM_STA] &= ~value;
+			break;
+		case PWM_FIF1:
+			if(fifoCount == PWM_FIFO_LENGTH) {
+				regs[REG_PWM][PWM_STA] |= (1 << PWM_STA_WERR1);
+				stats.droppedWrites++;
+			} else {
+				fifo[(fifoHead + fifoCount) % PWM_FIFO_LENGTH] = value;
+				fifoCount++;
+			}
+			break;
+		default:
+			regs[REG_PWM][reg] = value;
+			break;
+	}
+}
+
+// DMA
+// -------------------------------------------------------------------------------------------------
+
+unsigned char SimulatedBackend::loadControlBlock(SimDMAChannel_t *ch, unsigned int bus) {
+	dma_cb_t *cb = (dma_cb_t *)busToVirt(bus, sizeof(dma_cb_t));
+
+	if(cb == NULL) {
+		ch->cs |= (1 << DMA_CS_ERROR);
+		ch->cs &= ~(1 << DMA_CS_ACTIVE);
+		stats.dmaErrors++;
+		return false;
+	}
+	ch->conblk = bus;
+	ch->cb = *cb;
+	ch->done = 0;
+	return true;
+}
+
+// Let every active channel that feeds the PWM FIFO move words while the PWM is asking for them
+void SimulatedBackend::serviceDMA() {
+	unsigned int dmac = regs[REG_PWM][PWM_DMAC];
+	unsigned int threshold = (dmac >> PWM_DMAC_DREQ) & 0xFF;
+	int i;
+
+	for(i=0; i<15; i++) {
+		SimDMAChannel_t *ch = &channels[i];
+		if(!(ch->cs & (1 << DMA_CS_ACTIVE))) {
+			continue;
+		}
+		if(ch->cb.dest_ad != PWM_FIF1_BUS) {
+			continue;               // Only transfers into the PWM FIFO are modeled
+		}
+
+		for(;;) {
+			if(ch->done >= ch->cb.txfr_len) {
+				// On to the next control block, or finished
+				if(ch->cb.nextconbk == 0) {
+					ch->cs &= ~(1 << DMA_CS_ACTIVE);
+					ch->cs |= (1 << DMA_CS_END);
+					ch->conblk = 0;
+					break;
+				}
+				if(!loadControlBlock(ch, ch->cb.nextconbk)) {
+					break;
+				}
+				continue;
+			}
+
+			// Paced by DREQ: only write while the PWM wants data
+			if((ch->cb.ti & (1 << DMA_TI_DEST_DREQ)) &&
+			   (!(dmac & (1 << PWM_DMAC_ENAB)) || fifoCount >= threshold)) {
+				break;
+			}
+			if(fifoCount == PWM_FIFO_LENGTH) {
+				break;
+			}
+
+			unsigned int *src = (unsigned int *)busToVirt(ch->cb.source_ad + ch->done, 4);
+			if(src == NULL) {
+				ch->cs |= (1 << DMA_CS_ERROR);
+				ch->cs &= ~(1 << DMA_CS_ACTIVE);
+				stats.dmaErrors++;
+				break;
+			}
+			writePWM(PWM_FIF1, *src);
+			ch->done += 4;
+		}
+	}
+}
+
+unsigned int SimulatedBackend::readDMA(unsigned int reg) {
+	unsigned int channel = reg / DMA_CHANNEL_OFFSET(1);
+	unsigned int offset = reg % DMA_CHANNEL_OFFSET(1);
+
+	if(reg == DMA_ENABLE || channel >= 15) {
+		return regs[REG_DMA][reg];
+	}
+	switch(offset) {
+		case DMA_CS:
+			return channels[channel].cs;
+		case DMA_CONBLK_AD:
+			return channels[channel].conblk;
+		default:
+			return regs[REG_DMA][reg];
+	}
+}
+
+void SimulatedBackend::writeDMA(unsigned int reg, unsigned int value) {
+	unsigned int channel = reg / DMA_CHANNEL_OFFSET(1);
+	unsigned int offset = reg % DMA_CHANNEL_OFFSET(1);
+	unsigned int status = (1 << DMA_CS_ACTIVE) | (1 << DMA_CS_END) | (1 << DMA_CS_INT) | (1 << DMA_CS_ERROR);
+	SimDMAChannel_t *ch;
+
+	if(reg == DMA_ENABLE || channel >= 15) {
+		regs[REG_DMA][reg] = value;
+		return;
+	}
+	ch = &channels[channel];
+
+	switch(offset) {
+		case DMA_CS:
+			if(value & (1 << DMA_CS_RESET)) {
+				memset(ch, 0, sizeof(SimDMAChannel_t));
+				return;
+			}
+			// END and INT are cleared by writing 1 to them, ACTIVE is handled below, the
+			// priority and wait bits are just stored
+			ch->cs &= ~(value & ((1 << DMA_CS_END) | (1 << DMA_CS_INT)));
+			ch->cs = (ch->cs & status) | (value & ~(status | (1 << DMA_CS_ABORT)));
+
+			if(!(value & (1 << DMA_CS_ACTIVE)) || (value & (1 << DMA_CS_ABORT))) {
+				ch->cs &= ~(1 << DMA_CS_ACTIVE);
+			} else if(!(ch->cs & (1 << DMA_CS_ACTIVE))) {
+				// Starting: the channel has to be enabled and pointed at a control block
+				if((regs[REG_DMA][DMA_ENABLE] & (1 << channel)) && ch->conblk != 0 &&
+				   loadControlBlock(ch, ch->conblk)) {
+					ch->cs |= (1 << DMA_CS_ACTIVE);
+				}
+			}
+			break;
+		case DMA_CONBLK_AD:
+			ch->conblk = value;
+			break;
+		default:
+			regs[REG_DMA][reg] = value;
+			break;
+	}
+}
+
+// Inspection
+// -------------------------------------------------------------------------------------------------
+
+void SimulatedBackend::setRecording(unsigned char state) {
+	pthread_mutex_lock(&lock);
+	recording = state;
+	pthread_mutex_unlock(&lock);
+}
+
+std::vector<SimWireWord_t> SimulatedBackend::recordedWords() {
+	pthread_mutex_lock(&lock);
+	advance(nowNs());
+	std::vector<SimWireWord_t> copy = wire;
+	pthread_mutex_unlock(&lock);
+	return copy;
+}
+
+void SimulatedBackend::clearRecording() {
+	pthread_mutex_lock(&lock);
+	wire.clear();
+	pthread_mutex_unlock(&lock);
+}
+
+SimCounters_t SimulatedBackend::counters() {
+	pthread_mutex_lock(&lock);
+	advance(nowNs());
+	SimCounters_t copy = stats;
+	pthread_mutex_unlock(&lock);
+	return copy;
+}
+
+// Force fault (SIM_FAULT_*) once, as word period word of frame frame starts. Frames are counted
+// from 0, in the order the serializer starts them (see SimCounters_t.framesStarted), so a frame
+// sent again is a new one.
+void SimulatedBackend::injectFault(unsigned int type, unsigned long frame, unsigned int word) {
+	pthread_mutex_lock(&lock);
+	fault = type;
+	faultFrame = frame;
+	faultWord = word;
+	pthread_mutex_unlock(&lock);
+}
+
+// High pulses up to t0hMaxNs decode as 0 bits and up to t1hMaxNs as 1 bits, for LEDs slower
+// (or faster) than the WS2812B
+void SimulatedBackend::setPulseThresholds(unsigned int t0h, unsigned int t1h) {
+	pthread_mutex_lock(&lock);
+	t0hMaxNs = t0h;
+	t1hMaxNs = t1h;
+	pthread_mutex_unlock(&lock);
+}
+
+// Turn the words recorded on a PWM channel (1 or 2) back into frames of pixels, measuring each high
+// pulse the way an LED would. A low time of LED_RESET_US or more ends a frame.
+std::vector<SimFrame_t> SimulatedBackend::decodeFrames(unsigned int channel) {
+	std::vector<SimWireWord_t> all = recordedWords();
+	std::vector<SimWireWord_t> words;
+	std::vector<SimFrame_t> frames;
+	SimFrame_t frame;
+	unsigned long long resetNs = LED_RESET_US * 1000ULL;
+	unsigned long long lowSince = 0;        // When the line last went low
+	unsigned long long highSince = 0;       // When the line last went high
+	unsigned long long lastWordEnd = 0;
+	unsigned char line = 0;
+	unsigned char inFrame = false;
+	unsigned int bitCount = 0;
+	unsigned int colorBits = 0;
+	unsigned int i, b;
+
+	for(i=0; i<all.size(); i++) {
+		if(all[i].channel == channel) {
+			words.push_back(all[i]);
+		}
+	}
+
+	for(i=0; i<words.size(); i++) {
+		SimWireWord_t *w = &words[i];
+
+		// A hole between words: the line sits low (SBIT1 is 0) while the FIFO is empty
+		if(inFrame && w->startNs > lastWordEnd) {
+			if(w->startNs - lowSince < resetNs || line) {
+				frame.gaps++;
+				frame.gapNs += w->startNs - lastWordEnd;
+			}
+		}
+
+		for(b=0; b<w->bits; b++) {
+			unsigned char bit = b < 32 ? (w->word >> (31 - b)) & 1 : 0;
+			unsigned long long t = w->startNs + (unsigned long long)(b * w->bitNs + 0.5);
+
+			if(bit == line) {
+				continue;
+			}
+			if(bit) {
+				// Rising edge. If the line was low long enough, the LEDs latched the last frame.
+				if(!inFrame || t - lowSince >= resetNs) {
+					if(inFrame) {
+						frame.strayBits = bitCount;
+						frames.push_back(frame);
+					}
+					frame = SimFrame_t();
+					frame.startNs = t;
+					frame.gaps = 0;
+					frame.gapNs = 0;
+					frame.badSymbols = 0;
+					frame.strayBits = 0;
+					inFrame = true;
+					bitCount = 0;
+					colorBits = 0;
+				}
+				highSince = t;
+			} else {
+				// Falling edge: the length of the high pulse is the data bit
+				unsigned long long high = t - highSince;
+				if(high > t1hMaxNs) {
+					frame.badSymbols++;
+				} else {
+					colorBits = (colorBits << 1) | (high > t0hMaxNs ? 1 : 0);
+					if(++bitCount == 24) {
+						Color_t color;
+						color.g = (colorBits >> 16) & 0xFF;
+						color.r = (colorBits >> 8) & 0xFF;
+						color.b = colorBits & 0xFF;
+						frame.pixels.push_back(color);
+						bitCount = 0;
+						colorBits = 0;
+					}
+				}
+				frame.endNs = t;
+				lowSince = t;
+			}
+			line = bit;
+		}
+		lastWordEnd = w->startNs + (unsigned long long)(w->bits * w->bitNs + 0.5);
+	}
+	if(inFrame) {
+		frame.strayBits = bitCount;
+		frames.push_back(frame);
+	}
+	return frames;
+}
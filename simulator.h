@@ -0,0 +1,157 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <vector>
+
+#include "ws2812b.h"
+
+// Simulated peripherals
+// -------------------------------------------------------------------------------------------------
+// A RegisterBackend that models the parts of the GPIO, clock manager, PWM and DMA blocks that
+// ws2812b uses, so the driver can run (and be measured) on any Linux machine:
+//
+//  - Clock manager: PWM_CLK_CNTL/PWM_CLK_DIV with the password check, BUSY, KILL, the source
+//    select and the divisor (fractional part only with MASH on). The sources run at the nominal
+//    frequencies below.
+//  - PWM channels 1 and 2 in serializer mode: a shared 16-word FIFO, RNG1/RNG2, PWEN1/PWEN2, CLRF1,
+//    and the FULL1, EMPT1, STA1/STA2, GAPO1/GAPO2 and WERR1 status bits. Every word is shifted out
+//    in RNGx bit periods. With both channels on, the FIFO alternates between them.
+//  - DMA: control block chains that feed PWM_FIF1 paced by the PWM DREQ threshold, reading
+//    from memory handed out by allocDMAMemory().
+//
+// The model runs on the real monotonic clock: each register access first advances the serializer
+// to "now". So if the CPU feeds the FIFO too slowly, the model underruns, just like the hardware.
+// Every word that leaves the serializer is recorded with its modeled start time, and
+// decodeFrames() turns that bitstream back into GRB pixels. injectFault() makes a chosen frame go
+// wrong on purpose, to exercise the driver's error handling.
+
+// Nominal clock source frequencies
+#define SIM_OSC_HZ      19200000.0      // Source 1, oscillator
+#define SIM_PLLC_HZ     1000000000.0    // Source 5, PLLC
+#define SIM_PLLD_HZ     500000000.0     // Source 6, PLLD
+
+// WS2812 high-pulse classification used by the decoder (see setPulseThresholds())
+#define SIM_T0H_MAX_NS  550             // Shorter high pulses are 0 bits
+#define SIM_T1H_MAX_NS  1200            // Up to this they are 1 bits, longer ones are invalid
+
+// Faults injectFault() can force
+#define SIM_FAULT_GAP   1       // The FIFO runs dry: the line stays low for SIM_FAULT_GAP_NS, GAPOx
+#define SIM_FAULT_READ  2       // A FIFO read goes wrong: the word is lost, zeros go out, RERR1
+#define SIM_FAULT_GAP_NS 10000  // Long enough to see, too short for the LEDs to latch
+
+// One word as it left the serializer
+typedef struct SimWireWord_t {
+	unsigned int word;
+	unsigned int bits;              // RNGx at the time: how many bit periods the word took
+	unsigned int channel;           // PWM channel, 1 or 2
+	unsigned long long startNs;     // Modeled time the first bit went out
+	double bitNs;                   // Length of one bit period
+} SimWireWord_t;
+
+// A frame decoded back from the recorded bitstream. Frames are separated by the line being low for
+// at least LED_RESET_US.
+typedef struct SimFrame_t {
+	std::vector<Color_t> pixels;
+	unsigned long long startNs;     // First rising edge
+	unsigned long long endNs;       // End of the last data bit
+	unsigned int gaps;              // Times the FIFO ran dry in the middle of the frame
+	unsigned long long gapNs;       // Time lost to those gaps
+	unsigned int badSymbols;        // High pulses too long to be a 0 or a 1
+	unsigned int strayBits;         // Bits after the last whole LED
+} SimFrame_t;
+
+// Counters kept by the model
+typedef struct SimCounters_t {
+	unsigned long wordsShifted;
+	unsigned long gaps;             // FIFO ran dry and was refilled while the channel was enabled
+	unsigned long droppedWrites;    // FIFO writes while it was full (WERR1)
+	unsigned long abortedWords;     // Words cut off by clearing PWEN1
+	unsigned long dmaErrors;        // DMA reads from addresses we never handed out
+	unsigned long framesStarted;    // Times the channels were enabled from idle: one per frame sent
+	unsigned long faults;           // Faults forced by injectFault()
+} SimCounters_t;
+
+class SimulatedBackend : public RegisterBackend {
+	public:
+		SimulatedBackend();
+		~SimulatedBackend();
+
+		unsigned char map();
+		unsigned int read(int block, unsigned int reg);
+		void write(int block, unsigned int reg, unsigned int value);
+		unsigned char allocDMAMemory(unsigned int size, DMAMemory_t *mem);
+		void freeDMAMemory(DMAMemory_t *mem);
+		double clockSourceHz(unsigned int source);
+
+		// Inspection. Times are modeled nanoseconds since the backend was created.
+		unsigned long long nowNs();
+		void setRecording(unsigned char state);
+		std::vector<SimWireWord_t> recordedWords();
+		void clearRecording();
+		std::vector<SimFrame_t> decodeFrames(unsigned int channel = 1);
+		void setPulseThresholds(unsigned int t0hMaxNs, unsigned int t1hMaxNs);
+		SimCounters_t counters();
+		void injectFault(unsigned int fault, unsigned long frame, unsigned int word);
+
+	private:
+		pthread_mutex_t lock;
+		unsigned long long epochNs;
+		unsigned long long modelNs;     // How far the model has been advanced
+
+		unsigned int regs[REG_BLOCKS][BLOCK_SIZE / 4];  // Plain storage for everything not modeled
+
+		// PWM channels
+		unsigned int fifo[PWM_FIFO_LENGTH];
+		unsigned int fifoHead;
+		unsigned int fifoCount;
+		unsigned int shifting;          // Channels shifting out a word (bit 0: 1, bit 1: 2)
+		unsigned char starved;          // The FIFO ran dry since the channels were enabled
+		SimWireWord_t current[2];
+		unsigned long long wordEndNs;
+		unsigned int frameWords;        // Word periods since the channels were enabled
+
+		// Fault to force (see injectFault()), SIM_FAULT_* or 0
+		unsigned int fault;
+		unsigned long faultFrame;
+		unsigned int faultWord;
+
+		// DMA channels
+		typedef struct SimDMAChannel_t {
+			unsigned int cs;
+			unsigned int conblk;        // Bus address of the current control block
+			dma_cb_t cb;                // Copy of the current control block
+			unsigned int done;          // Bytes of it transferred
+		} SimDMAChannel_t;
+		SimDMAChannel_t channels[15];
+
+		typedef struct SimAllocation_t {
+			unsigned int bus;
+			unsigned int size;
+			unsigned char *mem;
+		} SimAllocation_t;
+		std::vector<SimAllocation_t> allocations;
+		unsigned int nextBus;
+
+		unsigned int t0hMaxNs;          // Decoder thresholds, SIM_T0H_MAX_NS and SIM_T1H_MAX_NS
+		unsigned int t1hMaxNs;          // unless set otherwise
+
+		unsigned char recording;
+		std::vector<SimWireWord_t> wire;
+		SimCounters_t stats;
+
+		void advance(unsigned long long now);
+		double bitPeriodNs();
+		unsigned int runningChannels();
+		void startWord(unsigned long long t, unsigned int channels);
+		void serviceDMA();
+		unsigned char loadControlBlock(SimDMAChannel_t *ch, unsigned int bus);
+		void *busToVirt(unsigned int bus, unsigned int size);
+		unsigned int readPWM(unsigned int reg);
+		void writePWM(unsigned int reg, unsigned int value);
+		unsigned int readCLK(unsigned int reg);
+		void writeCLK(unsigned int reg, unsigned int value);
+		unsigned int readDMA(unsigned int reg);
+		void writeDMA(unsigned int reg, unsigned int value);
+};
+
+#endif // SIMULATOR_H
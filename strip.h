@@ -0,0 +1,133 @@
+#ifndef STRIP_H
+#define STRIP_H
+
+#include <array>
+
+#include "encoder.h"
+
+// Compile-time specialized strips
+// -------------------------------------------------------------------------------------------------
+// ws2812bStrip<N, Order, Width> is a strip of N LEDs whose color order and pixel width (3 for RGB
+// parts like the WS2812B, 4 for RGBW parts like the SK6812) are fixed when it's compiled. Pixels
+// are stored in the order they go out on the wire, so setPixelColor() does the reordering through
+// constant offsets and the encoder just walks a byte stream: a loop of a known length over a table
+// built at compile time, with nothing left to decide about the format at run time.
+//
+// A strip sends through a ws2812b of its own, sized so its wire buffer has exactly the words the
+// strip encodes to. Set that up through output() (backend, transmit mode, initHardware()).
+// Needs C++14.
+//
+//   ws2812bStrip<300, ColorOrderGRB, 4> fixture;
+//   fixture.output().initHardware();
+//   fixture.setPixelColor(0, 255, 0, 0, 32);
+//   fixture.show();
+
+// Where each color goes in a pixel on the wire. The white byte of a 4-byte pixel always comes last.
+struct ColorOrderGRB { static const unsigned int R = 1, G = 0, B = 2; };
+struct ColorOrderRGB { static const unsigned int R = 0, G = 1, B = 2; };
+struct ColorOrderBRG { static const unsigned int R = 1, G = 2, B = 0; };
+struct ColorOrderRBG { static const unsigned int R = 0, G = 2, B = 1; };
+struct ColorOrderGBR { static const unsigned int R = 2, G = 0, B = 1; };
+struct ColorOrderBGR { static const unsigned int R = 2, G = 1, B = 0; };
+
+// buildWireTable(), at compile time
+struct StripWireTable_t {
+	unsigned int pattern[256];
+};
+
+constexpr StripWireTable_t makeStripWireTable() {
+	StripWireTable_t table = {};
+	for(int value=0; value<256; value++) {
+		unsigned int pattern = 0;
+		for(int i=7; i>=0; i--) {
+			pattern = (pattern << 3) | ((value & (1 << i)) ? 0x6 : 0x4);
+		}
+		table.pattern[value] = pattern;
+	}
+	return table;
+}
+
+static constexpr StripWireTable_t stripWireTable = makeStripWireTable();
+
+template <unsigned int N, typename Order = ColorOrderGRB, unsigned int Width = 3>
+class ws2812bStrip {
+	static_assert(Width == 3 || Width == 4, "pixels are 3 (RGB) or 4 (RGBW) bytes wide");
+	static_assert(N > 0, "a strip needs at least one LED");
+
+	public:
+		// Color bytes on the wire
+		static const unsigned int numBytes = N * Width;
+
+		// The ws2812b this strip sends through counts 3-byte LEDs. Its wire buffer of
+		// WIRE_WORDS(outputLEDs) words holds the encoded bytes plus, at most, some zero bits.
+		static const unsigned int outputLEDs = (numBytes + 2) / 3;
+		static const unsigned int wireLength = WIRE_WORDS(outputLEDs);
+
+		ws2812bStrip() : out(outputLEDs) {
+			pixels.fill(0);
+			wire.fill(0);
+		}
+
+		ws2812b &output() { return out; }
+
+		unsigned char setPixelColor(unsigned int pixel, unsigned char r, unsigned char g, unsigned char b, unsigned char w = 0) {
+			if(pixel >= N) {
+				printf("Unable to set pixel %d (don't have that many LEDs!)\n", pixel);
+				return false;
+			}
+			unsigned char *p = &pixels[pixel * Width];
+			p[Order::R] = r;
+			p[Order::G] = g;
+			p[Order::B] = b;
+			if(Width == 4) {
+				p[3] = w;
+			}
+			return true;
+		}
+
+		void clear() {
+			pixels.fill(0);
+		}
+
+		// The pixels in wire order, Width bytes each
+		unsigned char *data() { return pixels.data(); }
+
+		// Encode the pixels into wire words, four color bytes into three words at a time
+		void encode() {
+			const unsigned int *table = stripWireTable.pattern;
+			const unsigned char *p = pixels.data();
+			unsigned int *o = wire.data();
+			unsigned int i;
+
+			for(i=0; i+4<=numBytes; i+=4, p+=4, o+=3) {
+				PACK4(table[p[0]], table[p[1]], table[p[2]], table[p[3]], o);
+			}
+
+			// 1-3 bytes left over (known at compile time). The rest of the buffer stays zero.
+			if(numBytes % 4 != 0) {
+				unsigned int t[4] = { 0, 0, 0, 0 };
+				unsigned int tail[3];
+				for(i=0; i<numBytes % 4; i++) {
+					t[i] = table[p[i]];
+				}
+				PACK4(t[0], t[1], t[2], t[3], tail);
+				for(i=0; i<(numBytes % 4 * 24 + 31) / 32; i++) {
+					o[i] = tail[i];
+				}
+			}
+		}
+
+		const unsigned int *wireData() const { return wire.data(); }
+
+		void show() {
+			encode();
+			out.showWire(wire.data());
+		}
+
+	private:
+		std::array<unsigned char, numBytes> pixels;
+		std::array<unsigned int, wireLength> wire;
+		ws2812b out;
+};
+
+#endif // STRIP_H
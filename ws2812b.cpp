@@ -1,89 +1,441 @@
 #include <ws2812b.h>
+#include "encoder.h"
+#include "animation.h"
 
-ws2812b::ws2812b( unsigned int numLED ){
+// A zeroed LED buffer starting on a cache line (see LED_BUFFER_ALIGN), or NULL
+static Color_t *allocLEDBuffer(unsigned int numLEDs) {
+	void *buffer;
+	if(numLEDs > (size_t)-1 / sizeof(Color_t) ||
+	   posix_memalign(&buffer, LED_BUFFER_ALIGN, numLEDs * sizeof(Color_t)) != 0) {
+		return NULL;
+	}
+	memset(buffer, 0, numLEDs * sizeof(Color_t));
+	return (Color_t *)buffer;
+}
+
+ws2812b::ws2812b( unsigned int numLED, unsigned int numStrip ){
 	numLEDs = numLED;
+
+	// With two strips, the first half of the LEDs is on PWM channel 1 and the rest on channel 2.
+	// Each strip gets its own run of words in the wire buffer.
+	numStrips = (numStrip == 2) ? 2 : 1;
+	stripLength = (numLEDs + numStrips - 1) / numStrips;
+
+	// WS2812B timing until setWireFormat() says otherwise. The clock is set up in initHardware().
+	dataRate = DATA_RATE_WS2812B;
+	symbolBits = SYMBOL_BITS_3;
+	wireBitRate = (double)dataRate * symbolBits;
+	resetWords = 0;
+	stripWords = WIRE_WORDS_FOR(stripLength, symbolBits);
+	strip2Pin = 19;
+
+	// Size the LED and wire buffers for the whole chain
+	LEDBuffer = allocLEDBuffer(numLEDs);
+	frontBuffer = allocLEDBuffer(numLEDs);
+	PWMWaveformLength = numStrips * stripWords;
+	PWMWaveform = (unsigned int *)calloc(PWMWaveformLength, sizeof(unsigned int));
+	if(LEDBuffer == NULL || frontBuffer == NULL || PWMWaveform == NULL) {
+		// Carry on as a strip of no LEDs, so every setter is a no-op; initHardware() reports it
+		free(LEDBuffer);
+		free(frontBuffer);
+		free(PWMWaveform);
+		LEDBuffer = frontBuffer = NULL;
+		PWMWaveform = NULL;
+		numLEDs = stripLength = 0;
+		stripWords = PWMWaveformLength = 0;
+	}
+
+	encoder = encoderAvailable(ENCODER_NEON) ? ENCODER_NEON : ENCODER_SCALAR;
+
+	// No color correction to start with, and dithering is off until enableDithering()
+	stripGamma[0] = stripGamma[1] = 1.0;
+	brightness = 255;
+	whiteBalance[0] = whiteBalance[1] = whiteBalance[2] = 255;
+	buildWireTable(&plainTable, symbolBits);
+	deepBuffer = NULL;
+	deepFront = NULL;
+	ditherError = NULL;
+
+	// Nothing has been encoded yet
+	clearDirty(&backDirty);
+	clearDirty(&frontDirty);
+	clearDirty(&carryDirty);
+	markDirty(&backDirty, 0, numLEDs);
+	markDirty(&frontDirty, 0, numLEDs);
+
+	frameDeadline = 0;
+
+	pthread_mutex_init(&outputLock, NULL);
+	pthread_condattr_t condAttr;
+	pthread_condattr_init(&condAttr);
+	pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+	pthread_cond_init(&outputCond, &condAttr);
+	pthread_condattr_destroy(&condAttr);
+	outputThreadRunning = false;
+	stopOutputThread = false;
+	framePending = false;
+	frontBusy = false;
+	frameQueued = frameSent = frameDone = 0;
+	frameCallback = NULL;
+	frameCallbackArg = NULL;
+	outputPriority = 0;
+	outputCPU = -1;
+
+	maxRetries = DEFAULT_RETRIES;
+
+	memset(&stats, 0, sizeof(stats));
+	statsSequence = 0;
+	statsPage = NULL;
+	statsPageName[0] = '\0';
+
+	// Wire tables for no correction
+	updateWireTables();
+
+	regs = NULL;
+	sharedBackend = false;
+	mapped = false;
+
+	transmitMode = TX_MODE_FIFO;
+	memset(&dmaMemory, 0, sizeof(DMAMemory_t));
+	dmaCB = NULL;
+	dmaWire = NULL;
 }
 
+ws2812b::~ws2812b(){
+	if(outputThreadRunning) {
+		pthread_mutex_lock(&outputLock);
+		stopOutputThread = true;
+		pthread_cond_broadcast(&outputCond);
+		pthread_mutex_unlock(&outputLock);
+		pthread_join(outputThread, NULL);
+	}
+	pthread_cond_destroy(&outputCond);
+	pthread_mutex_destroy(&outputLock);
 
-// Map 4k register memory for direct access from user space and return a user space pointer to it.
-// See: http://infocenter.arm.com/help/index.jsp?topic=/com.arm.doc.faqs/ka3750.html,
-// The pointer addresses a 32-bit WORD, not an 8-bit byte. (So, addresses may seem 4x too small!)
-volatile unsigned *ws2812b::mapRegisterMemory(int base) {
-	static int mem_fd = 0;
-	char *mem, *map;
- 
-    /* open /dev/mem */
-	if (!mem_fd) {
-		if ((mem_fd = open("/dev/mem", O_RDWR|O_SYNC) ) < 0) {
-            //printf("can't open /dev/mem \n");
-			exit (-1);
-		}
+	if(mapped) {
+		waitForIdle();
+		freeDMA();
 	}
- 
-	/* mmap register */
-	// Allocate MAP block
-    if ((mem = (char *)malloc(BLOCK_SIZE + (PAGE_SIZE-1))) == NULL) {
+	if(sharedBackend) {
+		HardwareBackend::release((HardwareBackend *)regs);
+	}
+	unpublishStats();
+	free(ditherError);
+	free(deepFront);
+	free(deepBuffer);
+	free(PWMWaveform);
+	free(frontBuffer);
+	free(LEDBuffer);
+}
+
+// Choose how show() gets the waveform into the PWM FIFO. Call before initHardware().
+// TX_MODE_FIFO: the CPU streams the frame into the FIFO and is busy until the last word is in.
+// TX_MODE_DMA:  the DMA controller streams the frame and the CPU is free as soon as it starts.
+void ws2812b::setTransmitMode(unsigned char mode) {
+	transmitMode = mode;
+}
+
+// Choose how LEDBuffer[] is encoded (ENCODER_*). The default is NEON when this build and the CPU
+// support it. Returns false (and leaves the encoder alone) if type isn't available.
+unsigned char ws2812b::setEncoder(unsigned char type) {
+	if(!encoderAvailable(type)) {
+		printf("Encoder %d is not available in this build\n", type);
+		return false;
+	}
+	encoder = type;
+	return true;
+}
+
+// Send LED data at dataRate bits per second (DATA_RATE_*) with symbolBits wire bits per data bit
+// (SYMBOL_BITS_*). The PWM clock is set up for it in initHardware(), so call this before that.
+// Returns false (and leaves the format alone) if it can't be done.
+unsigned char ws2812b::setWireFormat(unsigned int rate, unsigned int bits) {
+	unsigned int *waveform;
+	unsigned int words;
+
+	if(bits != SYMBOL_BITS_3 && bits != SYMBOL_BITS_4) {
+		printf("Symbols are 3 or 4 wire bits, not %d\n", bits);
+		return false;
+	}
+	if(rate < MIN_DATA_RATE || rate > MAX_DATA_RATE) {
+		printf("Data rate %d is out of range (%d to %d)\n", rate, MIN_DATA_RATE, MAX_DATA_RATE);
+		return false;
+	}
+	if(mapped) {
+		printf("Set the wire format before initHardware()\n");
+		return false;
+	}
+
+	words = WIRE_WORDS_FOR(stripLength, bits);
+	if((waveform = (unsigned int *)calloc(numStrips * words, sizeof(unsigned int))) == NULL) {
 		printf("allocation error \n");
-		exit (-1);
+		return false;
 	}
- 
-	// Make sure pointer is on 4K boundary
-	if ((unsigned long)mem % PAGE_SIZE)
-		mem += PAGE_SIZE - ((unsigned long)mem % PAGE_SIZE);
- 
-		// Now map it
-		map = (char *)mmap(
-			(caddr_t)mem,
-			BLOCK_SIZE,
-			PROT_READ|PROT_WRITE,
-			MAP_SHARED|MAP_FIXED,
-			mem_fd,
-			base
-        );
- 
-        if ((long)map < 0) {
-			printf("mmap error %d\n", (int)map);
-			exit (-1);
-        }
- 
-        // Always use volatile pointer!
-        return (volatile unsigned *)map;
+	free(PWMWaveform);
+	PWMWaveform = waveform;
+	stripWords = words;
+	PWMWaveformLength = numStrips * words;
+
+	dataRate = rate;
+	symbolBits = bits;
+	wireBitRate = (double)rate * bits;
+
+	// New tables, and everything has to be encoded again
+	buildWireTable(&plainTable, symbolBits);
+	updateWireTables();
+	return true;
+}
+
+// Put the second strip on GPIO13 (ALT0) or GPIO19 (ALT5, the default). Call before initHardware().
+unsigned char ws2812b::setStrip2Pin(unsigned int pin) {
+	if(pin != 13 && pin != 19) {
+		printf("PWM channel 2 is only available on GPIO13 and GPIO19\n");
+		return false;
+	}
+	strip2Pin = pin;
+	return true;
+}
+
+// Scale all LEDs by level/255, on top of gamma and white balance
+void ws2812b::setBrightness(unsigned char level) {
+	brightness = level;
+	updateWireTables();
+}
+
+// Scale each color by r/255, g/255 and b/255, e.g. to take the blue cast out of white
+void ws2812b::setWhiteBalance(unsigned char r, unsigned char g, unsigned char b) {
+	whiteBalance[0] = r;
+	whiteBalance[1] = g;
+	whiteBalance[2] = b;
+	updateWireTables();
+}
+
+// Apply a gamma curve (out = in^gamma) to every strip. 1.0 turns it off; 2.2-2.8 suits most LEDs.
+void ws2812b::setGamma(float value) {
+	stripGamma[0] = stripGamma[1] = value;
+	updateWireTables();
+}
+
+// Apply a gamma curve to one strip (0 or 1) only, for strips of different LEDs
+unsigned char ws2812b::setGamma(unsigned int strip, float value) {
+	if(strip >= numStrips) {
+		printf("Unable to set gamma for strip %d (don't have that many strips!)\n", strip);
+		return false;
+	}
+	stripGamma[strip] = value;
+	updateWireTables();
+	return true;
 }
 
-// set up a memory regions to access GPIO, PWM and the clock manager
-void ws2812b::setupRegisterMemoryMappings() {
-	gpio = mapRegisterMemory(GPIO_BASE);
-	pwm = mapRegisterMemory(PWM_BASE);
-	clk = mapRegisterMemory(CLOCK_BASE);
-	dma = mapRegisterMemory(DMA_BASE);
+// Dithering. Give every LED 16 bits per channel (setPixelColor16(), setPixels16()) and let the
+// encoder spread the part below 8 bits over successive frames, so slow fades at low brightness
+// don't step. Color correction is then done in 16 bits, before dithering. Every frame re-encodes
+// the whole chain, since the dither pattern changes from frame to frame. The 8-bit setters keep
+// working and set the 16-bit buffer too. Returns false if the buffers can't be allocated.
+unsigned char ws2812b::enableDithering(unsigned char state) {
+	unsigned char ok = true;
+	unsigned int i;
+
+	// The output thread may be encoding from the buffers
+	pthread_mutex_lock(&outputLock);
+	while(frontBusy) {
+		pthread_cond_wait(&outputCond, &outputLock);
+	}
+
+	if(state && deepBuffer == NULL) {
+		deepBuffer = (Color16_t *)malloc(numLEDs * sizeof(Color16_t));
+		deepFront = (Color16_t *)malloc(numLEDs * sizeof(Color16_t));
+		ditherError = (unsigned char *)calloc(numLEDs, 3);
+		if(deepBuffer == NULL || deepFront == NULL || ditherError == NULL) {
+			printf("allocation error \n");
+			ok = false;
+			state = false;
+		} else {
+			// Start from what the 8-bit buffers hold
+			for(i=0; i<numLEDs; i++) {
+				deepBuffer[i].r = LEDBuffer[i].r * 257;
+				deepBuffer[i].g = LEDBuffer[i].g * 257;
+				deepBuffer[i].b = LEDBuffer[i].b * 257;
+				deepFront[i].r = frontBuffer[i].r * 257;
+				deepFront[i].g = frontBuffer[i].g * 257;
+				deepFront[i].b = frontBuffer[i].b * 257;
+			}
+		}
+	}
+	if(!state) {
+		free(ditherError);
+		free(deepFront);
+		free(deepBuffer);
+		deepBuffer = NULL;
+		deepFront = NULL;
+		ditherError = NULL;
+	}
+
+	markDirty(&backDirty, 0, numLEDs);
+	markDirty(&frontDirty, 0, numLEDs);
+	pthread_mutex_unlock(&outputLock);
+	return ok;
 }
 
+// Set pixel color with 16 bits per channel. Needs enableDithering().
+unsigned char ws2812b::setPixelColor16(unsigned int pixel, unsigned short r, unsigned short g, unsigned short b) {
+	if(deepBuffer == NULL) {
+		printf("Unable to set 16-bit colors (dithering is off)\n");
+		return false;
+	}
+	if(pixel >= numLEDs) {
+		printf("Unable to set pixel %d (don't have that many LEDs!)\n", pixel);
+		return false;
+	}
+	deepBuffer[pixel].r = r;
+	deepBuffer[pixel].g = g;
+	deepBuffer[pixel].b = b;
+	LEDBuffer[pixel] = RGB2Color(r >> 8, g >> 8, b >> 8);
+	return true;
+}
+
+// Copy count 16-bit pixels, starting at pixel first. Needs enableDithering().
+unsigned char ws2812b::setPixels16(unsigned int first, unsigned int count, const Color16_t *pixels) {
+	unsigned int i;
+
+	if(deepBuffer == NULL) {
+		printf("Unable to set 16-bit colors (dithering is off)\n");
+		return false;
+	}
+	if(!checkRange(first, count)) {
+		return false;
+	}
+	memcpy(deepBuffer + first, pixels, count * sizeof(Color16_t));
+	for(i=first; i<first + count; i++) {
+		LEDBuffer[i] = RGB2Color(pixels[i - first].r >> 8, pixels[i - first].g >> 8, pixels[i - first].b >> 8);
+	}
+	return true;
+}
+
+// Bring the 16-bit buffer up to date after the 8-bit setters changed LEDs first to first+count-1
+void ws2812b::copyToDeep(unsigned int first, unsigned int count) {
+	unsigned int i;
+	for(i=first; i<first + count; i++) {
+		deepBuffer[i].r = LEDBuffer[i].r * 257;
+		deepBuffer[i].g = LEDBuffer[i].g * 257;
+		deepBuffer[i].b = LEDBuffer[i].b * 257;
+	}
+}
+
+// Fold gamma, brightness and white balance into each strip's wire tables. Everything encoded so
+// far used the old tables, so the whole chain has to be re-encoded, but LEDBuffer[] isn't touched.
+void ws2812b::updateWireTables() {
+	unsigned char curve[256], lut[3][256];
+	unsigned int strip, value, c;
+
+	correcting = brightness != 255 || whiteBalance[0] != 255 || whiteBalance[1] != 255 || whiteBalance[2] != 255;
+
+	// The output thread may be encoding with the tables
+	pthread_mutex_lock(&outputLock);
+	while(frontBusy) {
+		pthread_cond_wait(&outputCond, &outputLock);
+	}
+
+	for(strip=0; strip<numStrips; strip++) {
+		if(stripGamma[strip] != 1.0) {
+			correcting = true;
+		}
+		for(value=0; value<256; value++) {
+			curve[value] = (unsigned char)(pow(value / 255.0, stripGamma[strip]) * 255.0 + 0.5);
+		}
+		for(c=0; c<3; c++) {
+			for(value=0; value<256; value++) {
+				lut[c][value] = (curve[value] * brightness * whiteBalance[c] + 65025 / 2) / 65025;
+			}
+		}
+		buildCorrectedWireTable(&wireTables[strip], lut[0], lut[1], lut[2], symbolBits);
+
+		// The same correction in 16 bits, for dithering
+		for(value=0; value<=256; value++) {
+			ditherCurves[strip].gamma[value] = (unsigned short)(pow(value / 256.0, stripGamma[strip]) * 65535.0 + 0.5);
+		}
+		for(c=0; c<3; c++) {
+			ditherCurves[strip].scale[c] = brightness * whiteBalance[c] * 65535U / 65025;
+		}
+	}
+
+	markDirty(&backDirty, 0, numLEDs);
+	markDirty(&frontDirty, 0, numLEDs);
+	pthread_mutex_unlock(&outputLock);
+}
+
+// Use backend for all register access instead of mapping the real registers (see peripheral.h).
+// Call before initHardware(). The backend is not deleted with this object.
+void ws2812b::setBackend(RegisterBackend *backend) {
+	regs = backend;
+	sharedBackend = false;
+}
+
+
 // Zero out the PWM waveform buffer
 void ws2812b::clearPWMBuffer() {
-	int i;
-	for(i=0; i<PWM_WAVEFORM_LENGTH; i++) {
+	unsigned int i;
+	for(i=0; i<PWMWaveformLength; i++) {
 		PWMWaveform[i] = 0x00000000;
 	}
 }
 
 // Zero out the LED buffer
 void ws2812b::clearLEDBuffer() {
-	int i;
-	for(i=0; i<LED_BUFFER_LENGTH; i++) {
+	unsigned int i;
+	for(i=0; i<numLEDs; i++) {
 		LEDBuffer[i].r = 0;
 		LEDBuffer[i].g = 0;
 		LEDBuffer[i].b = 0;
 	}
+	markDirty(&backDirty, 0, numLEDs);
+	if(deepBuffer != NULL) {
+		copyToDeep(0, numLEDs);
+	}
 }
 
-// Start or stop PWM output
+// Start or stop PWM output on every channel in use. Both channels start with the same write, so
+// they take their first words from the FIFO in order.
 void ws2812b::enablePWM(unsigned char state) {
-	*(pwm + PWM_CTL) |= (state << PWM_CTL_PWEN1);
+	unsigned int enable = 1 << PWM_CTL_PWEN1;
+	if(numStrips == 2) {
+		SETBIT(enable, PWM_CTL_PWEN2);
+	}
+	if(state) {
+		pwmWrite(PWM_CTL, pwmRead(PWM_CTL) | enable);
+	} else {
+		pwmWrite(PWM_CTL, pwmRead(PWM_CTL) & ~enable);
+	}
+}
+
+// PWM control word for serializer mode from the FIFO on every channel in use, not enabled yet
+unsigned int ws2812b::PWMControlWord() {
+	unsigned int controlWord = 0x00000000;
+	SETBIT(controlWord, PWM_CTL_MODE1);             // 1=Set serializer mode, 0=set PWM algorithm mode
+	CLRBIT(controlWord, PWM_CTL_RPTL1);             // 1=Repeat last contents if FIFO runs dry, 0=don't
+	CLRBIT(controlWord, PWM_CTL_SBIT1);             // Silence/padding bit (normally 0)
+	CLRBIT(controlWord, PWM_CTL_POLA1);             // Polarity (normally 0)
+	SETBIT(controlWord, PWM_CTL_USEF1);             // 1=Use FIFO, 0=Use DAT1 register
+	if(numStrips == 2) {
+		// Same for channel 2. The FIFO then hands out words to channel 1 and 2 alternately.
+		SETBIT(controlWord, PWM_CTL_MODE2);
+		SETBIT(controlWord, PWM_CTL_USEF2);
+	}
+	return controlWord;
 }
 
 // Is the FIFO empty?
 unsigned char ws2812b::FIFOEmpty() {
-	if(*(pwm + PWM_STA) & (1 << PWM_STA_EMPT1)) {
+	if(pwmRead(PWM_STA) & (1 << PWM_STA_EMPT1)) {
+		return true;
+	} else {
+		return false;
+	}
+}
+
+// Is the FIFO full?
+unsigned char ws2812b::FIFOFull() {
+	if(pwmRead(PWM_STA) & (1 << PWM_STA_FULL1)) {
 		return true;
 	} else {
 		return false;
@@ -99,19 +451,107 @@ Color_t ws2812b::RGB2Color(unsigned char r, unsigned char g, unsigned char b) {
 
 // Set pixel color (24-bit color)
 unsigned char ws2812b::setPixelColor(unsigned int pixel, unsigned char r, unsigned char g, unsigned char b) {
-	if(pixel < 0) {
-		printf("Unable to set pixel %d (less than zero?)\n", pixel);
-		return false;
-	}
-	if(pixel > LED_BUFFER_LENGTH - 1) {
+	if(pixel >= numLEDs) {
 		printf("Unable to set pixel %d (don't have that many LEDs!)\n", pixel);
 		return false;
 	} else {
 		LEDBuffer[pixel] = RGB2Color(r, g, b);
+		markDirty(&backDirty, pixel, pixel + 1);
+		if(deepBuffer != NULL) {
+			copyToDeep(pixel, 1);
+		}
 		return true;
 	}
 }
 
+// Are pixels first to first+count-1 all on the chain?
+unsigned char ws2812b::checkRange(unsigned int first, unsigned int count) {
+	if(first > numLEDs || count > numLEDs - first) {
+		printf("Unable to set pixels %d-%d (don't have that many LEDs!)\n", first, first + count - 1);
+		return false;
+	} else {
+		return true;
+	}
+}
+
+// Copy count pixels from a caller-owned frame buffer, starting at pixel first
+unsigned char ws2812b::setPixels(unsigned int first, unsigned int count, const Color_t *pixels) {
+	if(!checkRange(first, count)) {
+		return false;
+	}
+	memcpy(LEDBuffer + first, pixels, count * sizeof(Color_t));
+	markDirty(&backDirty, first, first + count);
+	if(deepBuffer != NULL) {
+		copyToDeep(first, count);
+	}
+	return true;
+}
+
+// Copy count pixels from packed R, G, B bytes. Color_t has the same layout, so this is one memcpy.
+unsigned char ws2812b::setPixelsRGB(unsigned int first, unsigned int count, const unsigned char *rgb) {
+	return setPixels(first, count, (const Color_t *)rgb);
+}
+
+// Copy count pixels from packed R, G, B, A bytes. The alpha byte is ignored.
+unsigned char ws2812b::setPixelsRGBA(unsigned int first, unsigned int count, const unsigned char *rgba) {
+	unsigned int i;
+	Color_t *out;
+
+	if(!checkRange(first, count)) {
+		return false;
+	}
+	out = LEDBuffer + first;
+	for(i=0; i<count; i++, rgba+=4) {
+		out[i].r = rgba[0];
+		out[i].g = rgba[1];
+		out[i].b = rgba[2];
+	}
+	markDirty(&backDirty, first, first + count);
+	if(deepBuffer != NULL) {
+		copyToDeep(first, count);
+	}
+	return true;
+}
+
+// Set count pixels starting at first to one color
+unsigned char ws2812b::fill(unsigned int first, unsigned int count, unsigned char r, unsigned char g, unsigned char b) {
+	unsigned int i;
+	Color_t color = RGB2Color(r, g, b);
+	Color_t *out;
+
+	if(!checkRange(first, count)) {
+		return false;
+	}
+	out = LEDBuffer + first;
+	for(i=0; i<count; i++) {
+		out[i] = color;
+	}
+	markDirty(&backDirty, first, first + count);
+	if(deepBuffer != NULL) {
+		copyToDeep(first, count);
+	}
+	return true;
+}
+
+// The LED buffer itself, for code that renders straight into it instead of going through the
+// setters. Call pixelsChanged() for whatever was written before the next show(). showAsync()
+// swaps the buffer out, so fetch it again after every showAsync().
+Color_t *ws2812b::pixelBuffer() {
+	return LEDBuffer;
+}
+
+// Pixels first to first+count-1 were written through pixelBuffer()
+unsigned char ws2812b::pixelsChanged(unsigned int first, unsigned int count) {
+	if(!checkRange(first, count)) {
+		return false;
+	}
+	markDirty(&backDirty, first, first + count);
+	if(deepBuffer != NULL) {
+		copyToDeep(first, count);
+	}
+	return true;
+}
+
 // Print some bits of a binary number (2nd arg is how many bits)
 void ws2812b::printBinary(unsigned int i, unsigned int bits) {
 	int x;
@@ -120,12 +560,13 @@ void ws2812b::printBinary(unsigned int i, unsigned int bits) {
 	}
 }
 
-// Set an individual bit in the PWM output array, accounting for word boundaries
+// Set an individual bit in the PWM output array, accounting for word boundaries.
+// Bits are numbered in the order they go out on the wire, so bit 0 is the MSB of word 0.
 void ws2812b::setPWMBit(unsigned int bitPos, unsigned char bit) {
  
 	// Fetch word the bit is in
 	unsigned int wordOffset = (int)(bitPos / 32);
-	unsigned int bitIdx = bitPos - (wordOffset * 32);
+	unsigned int bitIdx = 31 - (bitPos - (wordOffset * 32));
  
 	// printf("bitPos=%d wordOffset=%d bitIdx=%d value=%d\n", bitPos, wordOffset, bitIdx, bit);
 	switch(bit) {
@@ -143,7 +584,7 @@ unsigned char ws2812b::getPWMBit(unsigned int bitPos) {
  
 	// Fetch word the bit is in
 	unsigned int wordOffset = (int)(bitPos / 32);
-	unsigned int bitIdx = bitPos - (wordOffset * 32);
+	unsigned int bitIdx = 31 - (bitPos - (wordOffset * 32));
  
 	if(PWMWaveform[wordOffset] & (1 << bitIdx)) {
 		return true;
@@ -154,9 +595,9 @@ unsigned char ws2812b::getPWMBit(unsigned int bitPos) {
 
 // Debug: Dump contents of LED buffer.
 void ws2812b::dumpLEDBuffer() {
-	int i;
+	unsigned int i;
 	printf("Dumping LED buffer:\n");
-	for(i=0; i<LED_BUFFER_LENGTH; i++) {
+	for(i=0; i<numLEDs; i++) {
 		printf("R:%X G:%X B:%X\n", LEDBuffer[i].r, LEDBuffer[i].g, LEDBuffer[i].b);
 	}
 }
@@ -177,11 +618,11 @@ unsigned int ws2812b::reverseWord(unsigned int word) {
 }
 
 // Debug: Dump contents of PWM waveform.
-// The buffer is big enough to hold 170.66 commands, so the last number dumped will have only 2 digits!
+// The buffer is rounded up to whole words, so the last number dumped may have fewer than 3 digits!
 void ws2812b::dumpPWMBuffer() {
-	int i;
+	unsigned int i;
 	printf("Dumping PWM output buffer:\n");
-	for(i = 0; i < PWM_WAVEFORM_LENGTH * 32; i++) {
+	for(i = 0; i < PWMWaveformLength * 32; i++) {
 		printf("%d", getPWMBit(i));
 		if(i != 0 && i % 72 == 71) {
 			printf("\n");
@@ -198,32 +639,36 @@ void ws2812b::dumpPWMBuffer() {
 
 // Clear PWM errors (using SETBIT because you "clear" errors by writing a 1 to their bit positions)
 void ws2812b::clearPWMErrors() {
-	SETBIT(*(pwm + PWM_STA), PWM_STA_WERR1);
-	SETBIT(*(pwm + PWM_STA), PWM_STA_RERR1);
-	SETBIT(*(pwm + PWM_STA), PWM_STA_GAPO1);
-	SETBIT(*(pwm + PWM_STA), PWM_STA_BERR);
+	unsigned int errors = 0;
+	SETBIT(errors, PWM_STA_WERR1);
+	SETBIT(errors, PWM_STA_RERR1);
+	SETBIT(errors, PWM_STA_GAPO1);
+	SETBIT(errors, PWM_STA_GAPO2);
+	SETBIT(errors, PWM_STA_BERR);
+	pwmWrite(PWM_STA, errors);
 }
  
 // Clear the PWM FIFO
 void ws2812b::clearFIFO() {
-	SETBIT(*(pwm + PWM_CTL), PWM_CTL_CLRF1);
+	pwmWrite(PWM_CTL, pwmRead(PWM_CTL) | (1 << PWM_CTL_CLRF1));
 }
 
 // Display the status of the PWM's control register
 void ws2812b::dumpPWMStatus() {
+	unsigned int status = pwmRead(PWM_STA);
 	printf("PWM Status Register\n");
-	printf("    FULL1: %d\n", *(pwm + PWM_STA) & (1 << PWM_STA_FULL1) ? 1 : 0);
-	printf("    EMPT1: %d\n", *(pwm + PWM_STA) & (1 << PWM_STA_EMPT1) ? 1 : 0);
-	printf("    WERR1: %d\n", *(pwm + PWM_STA) & (1 << PWM_STA_WERR1) ? 1 : 0);
-	printf("    RERR1: %d\n", *(pwm + PWM_STA) & (1 << PWM_STA_RERR1) ? 1 : 0);
-	printf("    GAPO1: %d\n", *(pwm + PWM_STA) & (1 << PWM_STA_GAPO1) ? 1 : 0);
-	printf("     BERR: %d\n", *(pwm + PWM_STA) & (1 << PWM_STA_BERR) ? 1 : 0);
-	printf("     STA1: %d\n", *(pwm + PWM_STA) & (1 << PWM_STA_STA1) ? 1 : 0);
+	printf("    FULL1: %d\n", status & (1 << PWM_STA_FULL1) ? 1 : 0);
+	printf("    EMPT1: %d\n", status & (1 << PWM_STA_EMPT1) ? 1 : 0);
+	printf("    WERR1: %d\n", status & (1 << PWM_STA_WERR1) ? 1 : 0);
+	printf("    RERR1: %d\n", status & (1 << PWM_STA_RERR1) ? 1 : 0);
+	printf("    GAPO1: %d\n", status & (1 << PWM_STA_GAPO1) ? 1 : 0);
+	printf("     BERR: %d\n", status & (1 << PWM_STA_BERR) ? 1 : 0);
+	printf("     STA1: %d\n", status & (1 << PWM_STA_STA1) ? 1 : 0);
 }
  
  
 // Display the settings in a PWM control word
-// If you want to dump the register directly, use this: dumpPWMControl(*(pwm + PWM_CTL));
+// If you want to dump the register directly, use this: dumpPWMControl(pwmRead(PWM_CTL));
 void ws2812b::dumpPWMControl(unsigned int word) {
 	printf("PWM Control Register\n");
 	printf("    PWEN1: %d\n", word & (1 << PWM_CTL_PWEN1) ? 1 : 0);
@@ -236,134 +681,852 @@ void ws2812b::dumpPWMControl(unsigned int word) {
 	printf("    MSEN1: %d\n", word & (1 << PWM_CTL_MSEN1) ? 1 : 0);
 }
 
+// Allocate the DMA wire buffer and build the control block chain that feeds it to the PWM FIFO.
+// Layout of the (physically contiguous) block: control blocks first, then the wire words.
+// Returns false if the backend can't provide DMA memory.
+unsigned char ws2812b::setupDMA() {
+	unsigned int i;
+	unsigned int wireBytes, numCBs, cbBytes;
+
+	resetWords = (unsigned int)ceil(LED_RESET_US * wireBitRate / 1e6 / 32);
+	dmaWireLength = PWMWaveformLength + numStrips * resetWords;
+	wireBytes = dmaWireLength * sizeof(unsigned int);
+	numCBs = (wireBytes + DMA_MAX_CB_LENGTH - 1) / DMA_MAX_CB_LENGTH;
+	cbBytes = numCBs * sizeof(dma_cb_t);
+
+	if(!regs->allocDMAMemory(cbBytes + wireBytes, &dmaMemory)) {
+		return false;
+	}
+
+	dmaCB = (dma_cb_t *)dmaMemory.virt;
+	dmaWire = (unsigned int *)((unsigned char *)dmaMemory.virt + cbBytes);
+	memset(dmaWire, 0, wireBytes);
+
+	// One control block per DMA_MAX_CB_LENGTH bytes of wire data, each paced by the PWM DREQ
+	for(i=0; i<numCBs; i++) {
+		unsigned int offset = i * DMA_MAX_CB_LENGTH;
+		unsigned int length = wireBytes - offset;
+		if(length > DMA_MAX_CB_LENGTH) {
+			length = DMA_MAX_CB_LENGTH;
+		}
+
+		dmaCB[i].ti = (1 << DMA_TI_NO_WIDE_BURSTS) |
+		              (DMA_PERMAP_PWM << DMA_TI_PERMAP) |
+		              (1 << DMA_TI_SRC_INC) |
+		              (1 << DMA_TI_DEST_DREQ) |
+		              (1 << DMA_TI_WAIT_RESP);
+		dmaCB[i].source_ad = dmaMemory.bus + cbBytes + offset;
+		dmaCB[i].dest_ad = PWM_FIF1_BUS;
+		dmaCB[i].txfr_len = length;
+		dmaCB[i].stride = 0;
+		dmaCB[i].nextconbk = (i + 1 < numCBs) ? dmaMemory.bus + (i + 1) * sizeof(dma_cb_t) : 0;
+	}
+
+	// Enable the channel and give it a clean start
+	regs->write(REG_DMA, DMA_ENABLE, regs->read(REG_DMA, DMA_ENABLE) | (1 << DMA_CHANNEL));
+	stopDMA();
+
+	return true;
+}
+
+// Stop the DMA channel and give the DMA memory back
+void ws2812b::freeDMA() {
+	if(dmaMemory.virt != NULL) {
+		stopDMA();
+		regs->freeDMAMemory(&dmaMemory);
+		dmaCB = NULL;
+		dmaWire = NULL;
+	}
+}
+
+// Is the DMA channel still transferring?
+unsigned char ws2812b::DMAActive() {
+	if(dmaRead(DMA_CS) & (1 << DMA_CS_ACTIVE)) {
+		return true;
+	} else {
+		return false;
+	}
+}
+
+// Abort and reset the DMA channel, and clear its status bits
+void ws2812b::stopDMA() {
+	unsigned long long timeout = monotonicNs() + IDLE_TIMEOUT_US * 1000ULL;
+
+	dmaWrite(DMA_CS, 1 << DMA_CS_ABORT);
+	while(DMAActive() && monotonicNs() < timeout);
+	dmaWrite(DMA_CS, 1 << DMA_CS_RESET);
+	dmaWrite(DMA_CS, (1 << DMA_CS_INT) | (1 << DMA_CS_END));
+	dmaWrite(DMA_DEBUG, 7);         // Clear the read error, FIFO error and last-not-set flags
+}
+
+// Select alternate function alt (0-5) for a GPIO pin
+void ws2812b::setGPIOAlt(unsigned int pin, unsigned int alt) {
+	unsigned int fsel = regs->read(REG_GPIO, GPIO_FSEL_REG(pin));
+	fsel &= ~(7 << GPIO_FSEL_SHIFT(pin));
+	fsel |= GPIO_FSEL_ALT(alt) << GPIO_FSEL_SHIFT(pin);
+	regs->write(REG_GPIO, GPIO_FSEL_REG(pin), fsel);
+}
+
+// Wait for the clock generator's BUSY flag to become busy (true) or not (false).
+// Returns false if it didn't happen within CM_BUSY_TIMEOUT_US.
+unsigned char ws2812b::waitForClock(unsigned char busy) {
+	unsigned long long timeout = monotonicNs() + CM_BUSY_TIMEOUT_US * 1000ULL;
+	while(((clkRead(PWM_CLK_CNTL) >> CM_CNTL_BUSY) & 1) != busy) {
+		if(monotonicNs() > timeout) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Run the PWM clock at dataRate * symbolBits. PLLC, which the core clock also runs from, changes
+// speed with load, so the source is the oscillator or PLLD, whichever an integer divisor gets
+// closest with. If neither gets within CLOCK_TOLERANCE, PLLD is divided fractionally with the
+// MASH filter on, whose jitter (one PLLD cycle) is tiny next to a wire bit.
+// Returns false if no divisor reaches the rate, or the clock won't start.
+unsigned char ws2812b::setupClock() {
+	static const unsigned int sources[2] = { CLK_SRC_OSC, CLK_SRC_PLLD };
+	double wanted = (double)dataRate * symbolBits;
+	double best = 1e9, hz, error;
+	unsigned int source = CLK_SRC_OSC, idiv = 0, fdiv = 0, mash = 0, i, div;
+
+	for(i=0; i<2; i++) {
+		hz = regs->clockSourceHz(sources[i]);
+		div = (unsigned int)(hz / wanted + 0.5);
+		if(hz == 0 || div < 2 || div > 4095) {
+			continue;
+		}
+		error = fabs(hz / div - wanted) / wanted;
+		if(error < best) {
+			best = error;
+			source = sources[i];
+			idiv = div;
+		}
+	}
+	if(best > CLOCK_TOLERANCE && (hz = regs->clockSourceHz(CLK_SRC_PLLD)) > 0) {
+		// The fractional part is in 4096ths
+		double divisor = hz / wanted;
+		source = CLK_SRC_PLLD;
+		idiv = (unsigned int)divisor;
+		fdiv = (unsigned int)((divisor - idiv) * 4096 + 0.5);
+		if(fdiv == 4096) {
+			idiv++;
+			fdiv = 0;
+		}
+		mash = fdiv ? 1 : 0;
+	}
+	if(idiv < 2) {
+		printf("Unable to clock the PWM at %.0f Hz\n", wanted);
+		return false;
+	}
+	wireBitRate = regs->clockSourceHz(source) / (idiv + fdiv / 4096.0);
+
+	// If an earlier run (or another strip) left the clock running just like this, leave it be:
+	// stopping and restarting it only costs time
+	unsigned int cntl = (1 << CM_CNTL_ENAB) | (mash << CM_CNTL_MASH) | (source << CM_CNTL_SRC);
+	unsigned int cntlMask = (1 << CM_CNTL_BUSY) | (1 << CM_CNTL_ENAB) | (3 << CM_CNTL_MASH) | (0xF << CM_CNTL_SRC);
+	if((clkRead(PWM_CLK_CNTL) & cntlMask) == (cntl | (1 << CM_CNTL_BUSY)) &&
+	   (clkRead(PWM_CLK_DIV) & 0xFFFFFF) == ((idiv << 12) | fdiv)) {
+		return true;
+	}
+
+	// Stop the clock, keeping the source selected, and wait for BUSY to drop. If it won't stop,
+	// kill it. The divisor and MASH may only be changed while it's stopped.
+	clkWrite(PWM_CLK_CNTL, CM_PASSWD | (clkRead(PWM_CLK_CNTL) & (0xF << CM_CNTL_SRC)));
+	if(!waitForClock(false)) {
+		clkWrite(PWM_CLK_CNTL, CM_PASSWD | (1 << CM_CNTL_KILL));
+		waitForClock(false);
+	}
+
+	clkWrite(PWM_CLK_DIV, CM_PASSWD | (idiv << 12) | fdiv);
+	clkWrite(PWM_CLK_CNTL, CM_PASSWD | (mash << CM_CNTL_MASH) | (source << CM_CNTL_SRC));
+
+	// Enable the clock and wait for it to start
+	clkWrite(PWM_CLK_CNTL, CM_PASSWD | cntl);
+	if(!waitForClock(true)) {
+		printf("PWM clock didn't start\n");
+		return false;
+	}
+	return true;
+}
+
+// Is the previous frame still going out?
+unsigned char ws2812b::hardwareBusy() {
+	if(transmitMode == TX_MODE_DMA) {
+		return DMAActive();
+	}
+	if(!FIFOEmpty() || (pwmRead(PWM_STA) & ((1 << PWM_STA_STA1) | (1 << PWM_STA_STA2)))) {
+		return true;
+	} else {
+		return false;
+	}
+}
+
+// Block until the previous frame has been clocked out and latched by the LEDs.
+// frameDeadline is worked out from the wire length when the frame starts, so normally this is a
+// single sleep. If the hardware is still busy at that point the frame ran late (the FIFO feeder
+// fell behind), so wait for it and then give the LEDs their full reset time.
+void ws2812b::waitForIdle() {
+	unsigned long long start = monotonicNs();
+
+	if(start < frameDeadline) {
+		sleepUntilNs(frameDeadline);
+	}
+	if(hardwareBusy()) {
+		unsigned long long timeout = monotonicNs() + IDLE_TIMEOUT_US * 1000ULL;
+		while(hardwareBusy() && monotonicNs() < timeout);
+		sleepUntilNs(monotonicNs() + LED_RESET_US * 1000ULL);
+	}
+
+	beginStatsUpdate();
+	stats.waitNs += monotonicNs() - start;
+	endStatsUpdate();
+}
+
 // Initialize the PWM generator
-void ws2812b::initHardware() {
-	// mmap register space
-    setupRegisterMemoryMappings();
- 
-    // set PWM alternate function for GPIO18
-    SET_GPIO_ALT(18, 5);
+// Returns false if the registers can't be mapped, the PWM clock can't be set up, or the constructor
+// couldn't allocate the buffers. Once it has succeeded, calling it again does nothing.
+unsigned char ws2812b::initHardware() {
+	if(LEDBuffer == NULL) {
+		printf("Unable to allocate the LED and wire buffers\n");
+		return false;
+	}
+	if(mapped) {
+		return true;
+	}
 
-    // stop clock and waiting for busy flag doesn't work, so kill clock
-	*(clk + PWM_CLK_CNTL) = 0x5A000000 | (1 << 5);
-	usleep(1000);
- 
-	// Disable DMA
-	CLRBIT(*(pwm + PWM_DMAC), PWM_DMAC_ENAB);
-	usleep(1000);
- 
-	// Set up the PWM clock
-	// The fractional part is quantized to a range of 0-1024, so multiply the decimal part by 1024.
-	// E.g., 0.25 * 1024 = 256.
-	// So, if you want a divisor of 400.5, set idiv to 400 and fdiv to 512.
-	unsigned int idiv = 400;
-	unsigned short fdiv = 0;        // Should be 16 bits, but the value must be <= 1024
-	*(clk + PWM_CLK_DIV)  = 0x5A000000 | (idiv << 12) | fdiv;
-	usleep(1000);
- 
-	// Enable the clock.
-	// Next-to-last digit means "enable clock"
-	// Last digit is 1 (oscillator), 4 (PLLA), 5 (PLLC), or 6 (PLLD) (according to the docs) although
-	// PLLA doesn't seem to work.
-	// Note that the PLLs can be slowed down if the system is under heavy load - this may mean that
-	// eventually it's necessary to use another (slower) PLL or the oscillator. However, it may not
-	// matter under the operating conditions specific to any given project. I wouldn't change it
-	// unless necessary.
-	*(clk + PWM_CLK_CNTL) = 0x5A000015;
-	usleep(1000);
+	// mmap register space (shared with any other ws2812b in the process), unless we've been given
+	// a backend to use instead
+	if(regs == NULL) {
+		if((regs = HardwareBackend::acquire()) == NULL) {
+			printf("Unable to access the peripheral registers\n");
+			return false;
+		}
+		sharedBackend = true;
+	} else if(!regs->map()) {
+		printf("Unable to access the peripheral registers\n");
+		return false;
+	}
+	mapped = true;
  
-	// Disable PWM (by clearing the control register, including bit PWEN1)
-	*(pwm + PWM_CTL) = 0;
-	usleep(1000);
+    // set PWM alternate function for GPIO18, and for the second strip's pin
+    setGPIOAlt(18, 5);
+	if(numStrips == 2) {
+		setGPIOAlt(strip2Pin, strip2Pin == 13 ? 0 : 5);
+	}
+
+	// Disable PWM (by clearing the control register, including bit PWEN1) and DMA
+	pwmWrite(PWM_CTL, 0);
+	pwmWrite(PWM_DMAC, pwmRead(PWM_DMAC) & ~(1 << PWM_DMAC_ENAB));
+
+	if(!setupClock()) {
+		// Still holding the backend, which the destructor releases, but a later call tries again
+		mapped = false;
+		return false;
+	}
  
 	// Clear status registers (to remove errors)
-	//*(pwm + PWM_STA) = -1;
+	//pwmWrite(PWM_STA, -1);
  
 	// The range (transmitted word size) is 32 bits.
 	// >32: Pad with zeros.
 	// <32: Truncate.
-	*(pwm + PWM_RNG1) = 32;
-	usleep(1000);
+	pwmWrite(PWM_RNG1, 32);
+	pwmWrite(PWM_RNG2, 32);
  
 	// Clear any errors
 	clearPWMErrors();
-	usleep(1000);
  
 	// Set up PWM control registers
-	unsigned int controlWord = 0x00000000;
-	SETBIT(controlWord, PWM_CTL_MODE1);             // 1=Set serializer mode, 0=set PWM algorithm mode
-	CLRBIT(controlWord, PWM_CTL_RPTL1);             // 1=Repeat last contents if FIFO runs dry, 0=don't
-	CLRBIT(controlWord, PWM_CTL_SBIT1);             // Silence/padding bit (normally 0)
-	CLRBIT(controlWord, PWM_CTL_POLA1);             // Polarity (normally 0)
-	SETBIT(controlWord, PWM_CTL_USEF1);             // 1=Use FIFO, 0=Use DAT1 register
-	*(pwm + PWM_CTL) = controlWord;
-	usleep(1000);
+	pwmWrite(PWM_CTL, PWMControlWord());
  
+	// Set up the DMA buffer, falling back to writing the FIFO from the CPU if that fails
+	if(transmitMode == TX_MODE_DMA && !setupDMA()) {
+		printf("DMA unavailable, using the FIFO directly\n");
+		transmitMode = TX_MODE_FIFO;
+	}
+	return true;
 }
 
 // Write the LED buffer to the PWM FIFO input, translating it into the WS2812 wire format
 void ws2812b::show() {
 
-	// Set up PWM control registers
-	unsigned int controlWord = 0x00000000;
-	SETBIT(controlWord, PWM_CTL_MODE1);             // 1=Set serializer mode, 0=set PWM algorithm mode
-	CLRBIT(controlWord, PWM_CTL_RPTL1);             // 1=Repeat last contents if FIFO runs dry, 0=don't
-	CLRBIT(controlWord, PWM_CTL_SBIT1);             // Silence/padding bit (normally 0)
-	CLRBIT(controlWord, PWM_CTL_POLA1);             // Polarity (normally 0)
-	SETBIT(controlWord, PWM_CTL_USEF1);             // 1=Use FIFO, 0=Use DAT1 register
-	*(pwm + PWM_CTL) = controlWord;
-	usleep(1000);
+	// Don't fight the output thread over the hardware
+	if(outputThreadRunning) {
+		waitForFrame();
+	}
 
-	// Erase whatever might be in the PWM buffer
-	clearPWMBuffer();
- 
-	// Read data from LEDBuffer[], translate it into wire format, and write to PWMWaveform
-	int i, j;
-	unsigned int LEDBuffeWordPos = 0;
-	unsigned int PWMWaveformBitPos = 0;
-	unsigned int colorBits = 0;                     // Holds the GRB color before conversion to wire bit pattern
-	unsigned char colorBit = 0;                     // Holds current bit out of colorBits to be processed
-	unsigned int wireBit = 0;                       // Holds the current bit we will set in PWMWaveform
-	Color_t color;
- 
-	for(i=0; i<numLEDs; i++) {
-		// Create bits necessary to represent one color triplet (in GRB, not RGB, order)
-        //printf("RGB: %d, %d, %d\n     ", LEDBuffer[i].r, LEDBuffer[i].g, LEDBuffer[i].b);
-		colorBits = ((unsigned int)LEDBuffer[i].r << 8) | ((unsigned int)LEDBuffer[i].g << 16) | LEDBuffer[i].b;
-        //printBinary(colorBits, 24);
-        //printf(" (binary, GRB order)\n");
- 
-		//	printf("- Bits (GRB order): ");
-		//  printBinary(colorBits, 24);
-		//  printf("\n");
- 
-		// Iterate through color bits to get wire bits
-		for(j=23; j>=0; j--) {
-			colorBit = (colorBits & (1 << j)) ? 1 : 0;
-			switch(colorBit) {
-				case 1:
-					//wireBits = 0b110;     // High, High, Low
-					setPWMBit(wireBit++, 1);
-					setPWMBit(wireBit++, 1);
-					setPWMBit(wireBit++, 0);
-					break;
-				case 0:
-					//wireBits = 0b100;     // High, Low, Low
-					setPWMBit(wireBit++, 1);
-					setPWMBit(wireBit++, 0);
-					setPWMBit(wireBit++, 0);
-					break;
-            }
-		}
-	}
-
-	// Stop PWM (assuming it's running)
-	enablePWM(false);
-	usleep(1000);
+	encodeBackBuffer();
+	transmit(PWMWaveform);
+}
+
+// Translate the changed part of LEDBuffer[] into wire format in PWMWaveform[]. The output thread
+// may have encoded frames since, so pick those changes up too. Afterwards the front buffer differs
+// from PWMWaveform[] wherever the back buffer did.
+void ws2812b::encodeBackBuffer() {
+	pthread_mutex_lock(&outputLock);
+	markDirty(&backDirty, carryDirty.first, carryDirty.end);
+	markDirty(&frontDirty, backDirty.first, backDirty.end);
+	clearDirty(&carryDirty);
+	pthread_mutex_unlock(&outputLock);
+	encodeDirty(LEDBuffer, deepBuffer, &backDirty);
+}
+
+// Re-encode the dirty part of pixels[] into PWMWaveform[], already in serializer bit order and
+// color corrected. Each strip is encoded into its own run of stripWords words. The NEON encoder
+// only knows the plain wire pattern, so correction means the scalar one. With dithering, deep
+// holds the same pixels in 16 bits and the whole chain is encoded from it.
+void ws2812b::encodeDirty(const Color_t *pixels, const Color16_t *deep, DirtyRange_t *dirty) {
+	unsigned int strip, base, length;
+	unsigned long long start = monotonicNs();
+
+	for(strip=0; strip<numStrips; strip++) {
+		base = strip * stripLength;
+		if(base >= numLEDs) {
+			continue;
+		}
+		length = numLEDs - base < stripLength ? numLEDs - base : stripLength;
+
+		// Dithering: everything, from the 16-bit pixels
+		if(deep != NULL) {
+			encodeWireDithered(&plainTable, &ditherCurves[strip], deep + base, ditherError + base * 3,
+			                   length, PWMWaveform + strip * stripWords);
+			continue;
+		}
+		if(dirty->end <= base) {
+			continue;
+		}
+		encodeWireRange(correcting ? ENCODER_SCALAR : encoder, &wireTables[strip], pixels + base, length,
+		                dirty->first > base ? dirty->first - base : 0, dirty->end - base,
+		                PWMWaveform + strip * stripWords);
+	}
+	clearDirty(dirty);
+
+	unsigned long long elapsed = monotonicNs() - start;
+	beginStatsUpdate();
+	stats.encodes++;
+	stats.encodeNs += elapsed;
+	if(elapsed > stats.encodeMaxNs) {
+		stats.encodeMaxNs = elapsed;
+	}
+	endStatsUpdate();
+}
+
+// Send PWMWaveformLength words of wire data with whichever transmit mode is set up. If the FIFO
+// ran dry or the serializer hit a read error part way, the LEDs past that point latched garbage,
+// so the frame is sent again, up to maxRetries times.
+void ws2812b::transmit(const unsigned int *wire) {
+	unsigned int attempt;
+	unsigned char clean;
+
+	for(attempt=0; ; attempt++) {
+		if(transmitMode == TX_MODE_DMA) {
+			clean = showDMA(wire, maxRetries > 0);
+		} else {
+			clean = showFIFO(wire);
+		}
+		if(clean || attempt >= maxRetries) {
+			break;
+		}
+		beginStatsUpdate();
+		stats.retransmits++;
+		endStatsUpdate();
+	}
+
+	beginStatsUpdate();
+	stats.frames++;
+	if(!clean) {
+		stats.corruptFrames++;
+	}
+	endStatsUpdate();
+}
+
+// How many times to resend a frame that went out corrupted (0: never). Checking a frame in DMA
+// mode means waiting until the DMA has handed all of it to the FIFO, so with retries on, show()
+// only returns then; showAsync() does that wait on the output thread instead.
+void ws2812b::setRetryPolicy(unsigned int retries) {
+	pthread_mutex_lock(&outputLock);
+	maxRetries = retries;
+	pthread_mutex_unlock(&outputLock);
+}
+
+// Count the errors in PWM_STA (and the DMA channel) and clear them. GAPO is only meaningful while
+// a frame is still being fed: once it has drained, the FIFO running dry is normal.
+// Returns true if the frame was corrupted by a gap, a FIFO read error or a DMA error.
+unsigned char ws2812b::sampleErrors(unsigned char gaps) {
+	unsigned int status = pwmRead(PWM_STA);
+	unsigned int seen = status & ((1 << PWM_STA_RERR1) | (1 << PWM_STA_WERR1) | (1 << PWM_STA_BERR));
+	unsigned char dmaError = false;
+
+	if(gaps) {
+		seen |= status & ((1 << PWM_STA_GAPO1) | (1 << PWM_STA_GAPO2));
+	}
+	if(transmitMode == TX_MODE_DMA && (dmaRead(DMA_CS) & (1 << DMA_CS_ERROR))) {
+		dmaError = true;
+	}
+	if(!seen && !dmaError) {
+		return false;
+	}
+
+	beginStatsUpdate();
+	if(seen & ((1 << PWM_STA_GAPO1) | (1 << PWM_STA_GAPO2))) stats.gapErrors++;
+	if(seen & (1 << PWM_STA_RERR1)) stats.readErrors++;
+	if(seen & (1 << PWM_STA_WERR1)) stats.writeErrors++;
+	if(seen & (1 << PWM_STA_BERR)) stats.busErrors++;
+	if(dmaError) stats.dmaErrors++;
+	endStatsUpdate();
+
+	pwmWrite(PWM_STA, seen);
+	if(dmaError) {
+		dmaWrite(DMA_DEBUG, 7);
+	}
+
+	return (seen & ((1 << PWM_STA_GAPO1) | (1 << PWM_STA_GAPO2) | (1 << PWM_STA_RERR1))) || dmaError;
+}
+
+// Statistics
+// -------------------------------------------------------------------------------------------------
+// The counters are only written by whichever thread is driving the hardware, inside
+// beginStatsUpdate()/endStatsUpdate(). The sequence number is odd while an update is going on, so
+// readers (getStats(), or another process reading the shared page) retry until they get a
+// consistent copy, and never hold up the output.
+
+void ws2812b::beginStatsUpdate() {
+	statsSequence++;
+	__sync_synchronize();
+}
+
+void ws2812b::endStatsUpdate() {
+	__sync_synchronize();
+	statsSequence++;
+
+	if(statsPage != NULL) {
+		statsPage->sequence++;
+		__sync_synchronize();
+		memcpy((void *)&statsPage->stats, &stats, sizeof(OutputStats_t));
+		__sync_synchronize();
+		statsPage->sequence++;
+	}
+}
+
+// Consistent snapshot of the counters. Safe to call from any thread while frames are going out.
+void ws2812b::getStats(OutputStats_t *out) {
+	unsigned int sequence;
+	do {
+		sequence = statsSequence;
+		__sync_synchronize();
+		memcpy(out, (const void *)&stats, sizeof(OutputStats_t));
+		__sync_synchronize();
+	} while((sequence & 1) || sequence != statsSequence);
+}
+
+void ws2812b::resetStats() {
+	beginStatsUpdate();
+	memset((void *)&stats, 0, sizeof(OutputStats_t));
+	endStatsUpdate();
+}
+
+// Mirror the counters into a POSIX shared memory object (e.g. "/ws2812b"), laid out as a
+// StatsPage_t, for monitors in other processes (see neo-stats.cpp). It's updated along with the
+// counters and removed when this object is destroyed. Returns false if it can't be created.
+unsigned char ws2812b::publishStats(const char *name) {
+	int fd;
+	StatsPage_t *page;
+
+	unpublishStats();
+	if(strlen(name) >= sizeof(statsPageName)) {
+		printf("Shared memory name %s is too long\n", name);
+		return false;
+	}
+	if((fd = shm_open(name, O_RDWR | O_CREAT, 0644)) < 0) {
+		printf("Unable to create shared memory %s\n", name);
+		return false;
+	}
+	if(ftruncate(fd, sizeof(StatsPage_t)) != 0) {
+		printf("Unable to size shared memory %s\n", name);
+		close(fd);
+		return false;
+	}
+	page = (StatsPage_t *)mmap(NULL, sizeof(StatsPage_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(page == MAP_FAILED) {
+		printf("Unable to map shared memory %s\n", name);
+		return false;
+	}
+
+	memset(page, 0, sizeof(StatsPage_t));
+	memcpy(page->magic, STATS_MAGIC, 4);
+	page->version = STATS_VERSION;
+	page->numLEDs = numLEDs;
+	strcpy(statsPageName, name);
+	statsPage = page;
+
+	beginStatsUpdate();
+	endStatsUpdate();
+	return true;
+}
+
+void ws2812b::unpublishStats() {
+	if(statsPage != NULL) {
+		munmap((void *)statsPage, sizeof(StatsPage_t));
+		shm_unlink(statsPageName);
+		statsPage = NULL;
+		statsPageName[0] = '\0';
+	}
+}
+
+// Send a frame that is already in wire format (PWMWaveformLength words, in the layout encodeWire()
+// produces, one run of words per strip), skipping the LED buffer and the encoder altogether
+void ws2812b::showWire(const unsigned int *wire) {
+	if(outputThreadRunning) {
+		waitForFrame();
+	}
+	transmit(wire);
+}
+
+void initFrameSequence(FrameSequence_t *seq) {
+	memset(seq, 0, sizeof(FrameSequence_t));
+}
+
+void freeFrameSequence(FrameSequence_t *seq) {
+	free(seq->words);
+	free(seq->intervalUs);
+	initFrameSequence(seq);
+}
+
+// Encode the LED buffer and append it to seq, to be shown for intervalUs when replayed.
+// Nothing is transmitted. All frames in a sequence must come from chains of the same length.
+unsigned char ws2812b::captureFrame(FrameSequence_t *seq, unsigned int intervalUs) {
+	if(seq->numFrames == 0) {
+		seq->frameLength = PWMWaveformLength;
+	} else if(seq->frameLength != PWMWaveformLength) {
+		printf("Unable to capture frame (sequence is for a different number of LEDs)\n");
+		return false;
+	}
+
+	// Grow by doubling
+	if(seq->numFrames == seq->capacity) {
+		unsigned int capacity = seq->capacity ? seq->capacity * 2 : 16;
+		unsigned int *words = (unsigned int *)realloc(seq->words, (size_t)capacity * seq->frameLength * sizeof(unsigned int));
+		unsigned int *interval = (unsigned int *)realloc(seq->intervalUs, capacity * sizeof(unsigned int));
+		if(words != NULL) {
+			seq->words = words;
+		}
+		if(interval != NULL) {
+			seq->intervalUs = interval;
+		}
+		if(words == NULL || interval == NULL) {
+			printf("allocation error \n");
+			return false;
+		}
+		seq->capacity = capacity;
+	}
+
+	// Same encoding path as show(), so only the changed LEDs are re-encoded
+	if(outputThreadRunning) {
+		waitForFrame();
+	}
+	encodeBackBuffer();
+
+	memcpy(seq->words + (size_t)seq->numFrames * seq->frameLength, PWMWaveform, seq->frameLength * sizeof(unsigned int));
+	seq->intervalUs[seq->numFrames] = intervalUs;
+	seq->numFrames++;
+	return true;
+}
+
+// Replay a captured sequence loops times (0: forever), with no encoding
+void ws2812b::playFrames(const FrameSequence_t *seq, unsigned int loops) {
+	if(seq->numFrames == 0) {
+		return;
+	}
+	if(seq->frameLength != PWMWaveformLength) {
+		printf("Unable to play frames (sequence is for a different number of LEDs)\n");
+		return;
+	}
+	playWire(seq->words, seq->frameLength, seq->numFrames, seq->intervalUs, 0, loops);
+}
+
+// Play a mapped animation file loops times (0: forever). Frames are sent straight from the
+// mapping, with no copying (beyond the DMA buffer) and no encoding.
+void ws2812b::playAnimation(const Animation_t *anim, unsigned int loops) {
+	if(anim->header->numFrames == 0) {
+		return;
+	}
+	if(symbolBits != SYMBOL_BITS_3) {
+		printf("Unable to play animation (it is encoded with 3-bit symbols)\n");
+		return;
+	}
+	if(anim->header->frameLength != PWMWaveformLength) {
+		printf("Unable to play animation (it is for %d LEDs, not %d)\n", anim->header->numLEDs, numLEDs);
+		return;
+	}
+	// Files hold one chain. Split in two, that's the same words only if strip 1 ends on a word.
+	if(numStrips == 2 && stripLength % 4 != 0) {
+		printf("Unable to play animation (strips of %d LEDs don't split it on a word boundary)\n", stripLength);
+		return;
+	}
+	playWire(anim->frames, anim->header->frameLength, anim->header->numFrames, NULL, anim->header->frameIntervalUs, loops);
+}
+
+// Send numFrames consecutive wire frames loops times (0: forever). Frame n stays up for
+// intervalUs[n], or fixedIntervalUs if intervalUs is NULL (0: send the next as soon as possible).
+// Pacing is against absolute deadlines, so timing errors don't add up.
+void ws2812b::playWire(const unsigned int *words, unsigned int frameLength, unsigned int numFrames,
+                       const unsigned int *intervalUs, unsigned int fixedIntervalUs, unsigned int loops) {
+	unsigned int i, loop, interval;
+	unsigned long long deadline;
+
+	if(outputThreadRunning) {
+		waitForFrame();
+	}
+
+	deadline = monotonicNs();
+	for(loop=0; loops == 0 || loop < loops; loop++) {
+		for(i=0; i<numFrames; i++) {
+			sleepUntilNs(deadline);
+			transmit(words + (size_t)i * frameLength);
+			interval = intervalUs ? intervalUs[i] : fixedIntervalUs;
+			if(interval) {
+				deadline += interval * 1000ULL;
+			} else {
+				deadline = monotonicNs();
+			}
+		}
+	}
+}
+
+// Queue the LED buffer for display on the output thread and return straight away.
+// The LED buffer is swapped with the thread's front buffer, so after this call setPixelColor()
+// writes into the buffer of an *earlier* frame, not a copy of the one just queued. If the thread
+// hasn't picked up the previous frame yet, that frame is replaced. Returns the frame number to
+// pass to waitForFrame().
+unsigned long ws2812b::showAsync() {
+	Color_t *swap;
+	unsigned long frame;
+
+	pthread_mutex_lock(&outputLock);
+	if(!outputThreadRunning) {
+		if(pthread_create(&outputThread, NULL, outputThreadEntry, this) != 0) {
+			pthread_mutex_unlock(&outputLock);
+			printf("Unable to start the output thread, showing synchronously\n");
+			show();
+			return frameQueued;
+		}
+		outputThreadRunning = true;
+		if(outputPriority > 0 || outputCPU >= 0) {
+			setThreadPolicy(outputThread, outputPriority, outputCPU);
+		}
+	}
+
+	// The thread may still be encoding from the front buffer
+	while(frontBusy) {
+		pthread_cond_wait(&outputCond, &outputLock);
+	}
+
+	swap = frontBuffer;
+	frontBuffer = LEDBuffer;
+	LEDBuffer = swap;
+	if(deepBuffer != NULL) {
+		Color16_t *deepSwap = deepFront;
+		deepFront = deepBuffer;
+		deepBuffer = deepSwap;
+	}
+
+	// The outgoing back buffer also misses everything encoded while it was the back buffer
+	DirtyRange_t dirty = backDirty;
+	markDirty(&dirty, carryDirty.first, carryDirty.end);
+	clearDirty(&carryDirty);
+	backDirty = frontDirty;
+	frontDirty = dirty;
+
+	framePending = true;
+	frame = ++frameQueued;
+	pthread_cond_broadcast(&outputCond);
+	pthread_mutex_unlock(&outputLock);
+
+	return frame;
+}
+
+// Block until the given frame (or a later one that replaced it) has been clocked out
+void ws2812b::waitForFrame(unsigned long frame) {
+	pthread_mutex_lock(&outputLock);
+	while(outputThreadRunning && frameDone < frame) {
+		pthread_cond_wait(&outputCond, &outputLock);
+	}
+	pthread_mutex_unlock(&outputLock);
+}
+
+// Block until the output thread has taken the last frame passed to showAsync(), so the next
+// showAsync() queues behind it instead of replacing it
+void ws2812b::waitForQueue() {
+	pthread_mutex_lock(&outputLock);
+	while(outputThreadRunning && (framePending || frontBusy)) {
+		pthread_cond_wait(&outputCond, &outputLock);
+	}
+	pthread_mutex_unlock(&outputLock);
+}
+
+// Block until every frame queued with showAsync() has been clocked out
+void ws2812b::waitForFrame() {
+	pthread_mutex_lock(&outputLock);
+	unsigned long frame = frameQueued;
+	pthread_mutex_unlock(&outputLock);
+	waitForFrame(frame);
+}
+
+// Have the output thread call callback(arg, frame) each time a frame has been clocked out.
+// It runs on the output thread, so keep it short.
+void ws2812b::setFrameCallback(void (*callback)(void *arg, unsigned long frame), void *arg) {
+	pthread_mutex_lock(&outputLock);
+	frameCallback = callback;
+	frameCallbackArg = arg;
+	pthread_mutex_unlock(&outputLock);
+}
+
+// Run the output thread with SCHED_FIFO priority (1-99, 0: normal scheduling) and pinned to cpu
+// (-1: any). Takes effect straight away if the thread is running, otherwise when it starts.
+// Real-time priority needs root (or CAP_SYS_NICE).
+unsigned char ws2812b::setOutputThreadPolicy(int priority, int cpu) {
+	unsigned char ok = true;
+
+	pthread_mutex_lock(&outputLock);
+	outputPriority = priority;
+	outputCPU = cpu;
+	if(outputThreadRunning) {
+		ok = setThreadPolicy(outputThread, priority, cpu);
+	}
+	pthread_mutex_unlock(&outputLock);
+	return ok;
+}
+
+// Give a thread SCHED_FIFO priority (0: back to normal scheduling) and pin it to cpu (-1: leave
+// it alone). Returns false (and prints why) if either can't be done.
+unsigned char setThreadPolicy(pthread_t thread, int priority, int cpu) {
+	struct sched_param param;
+	unsigned char ok = true;
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+	if(pthread_setschedparam(thread, priority > 0 ? SCHED_FIFO : SCHED_OTHER, &param) != 0) {
+		printf("Unable to set real-time priority %d\n", priority);
+		ok = false;
+	}
+	if(cpu >= 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		if(pthread_setaffinity_np(thread, sizeof(cpus), &cpus) != 0) {
+			printf("Unable to pin thread to CPU %d\n", cpu);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+void *ws2812b::outputThreadEntry(void *arg) {
+	((ws2812b *)arg)->outputLoop();
+	return NULL;
+}
+
+// The output thread. It owns the peripheral from the first showAsync() on: it encodes each queued
+// frame while the previous one is still on the wire, then waits for the wire and sends it.
+void ws2812b::outputLoop() {
+	unsigned long frame;
+	DirtyRange_t dirty;
+	const Color16_t *deep;
+
+	pthread_mutex_lock(&outputLock);
+	for(;;) {
+		while(!framePending && !stopOutputThread) {
+			if(frameSent != frameDone && monotonicNs() < frameDeadline) {
+				// Nothing new to send. Sleep until the last frame should be out, but on the
+				// condition, so a frame queued meanwhile is taken and encoded at once.
+				struct timespec ts;
+				ts.tv_sec = frameDeadline / 1000000000ULL;
+				ts.tv_nsec = frameDeadline % 1000000000ULL;
+				pthread_cond_timedwait(&outputCond, &outputLock, &ts);
+				continue;
+			}
+			if(frameSent != frameDone) {
+				// The last frame should be out by now: make sure of it and report it
+				pthread_mutex_unlock(&outputLock);
+				waitForIdle();
+				completeFrame(frameSent);
+				pthread_mutex_lock(&outputLock);
+				continue;
+			}
+			pthread_cond_wait(&outputCond, &outputLock);
+		}
+		if(stopOutputThread) {
+			break;
+		}
+
+		// Take the frame
+		framePending = false;
+		frontBusy = true;
+		frame = frameQueued;
+		dirty = frontDirty;
+		deep = deepFront;
+		pthread_mutex_unlock(&outputLock);
+
+		encodeDirty(frontBuffer, deep, &dirty);
+
+		// PWMWaveform[] now matches the front buffer, and the back buffer has to catch up with it
+		pthread_mutex_lock(&outputLock);
+		markDirty(&carryDirty, frontDirty.first, frontDirty.end);
+		clearDirty(&frontDirty);
+		frontBusy = false;
+		pthread_cond_broadcast(&outputCond);
+		pthread_mutex_unlock(&outputLock);
+
+		// The previous frame has to finish before this one can go out
+		waitForIdle();
+		if(frameSent != frameDone) {
+			completeFrame(frameSent);
+		}
+		transmit(PWMWaveform);
+
+		pthread_mutex_lock(&outputLock);
+		frameSent = frame;
+	}
+	pthread_mutex_unlock(&outputLock);
+}
+
+// Record that a frame has been clocked out, and tell anyone waiting for it
+void ws2812b::completeFrame(unsigned long frame) {
+	void (*callback)(void *arg, unsigned long frame);
+	void *arg;
+
+	pthread_mutex_lock(&outputLock);
+	frameDone = frame;
+	callback = frameCallback;
+	arg = frameCallbackArg;
+	pthread_cond_broadcast(&outputCond);
+	pthread_mutex_unlock(&outputLock);
+
+	if(callback != NULL) {
+		callback(arg, frame);
+	}
+}
+
+// Stream wire[] into the FIFO from the CPU, topping it up whenever there's room, until the whole
+// frame has been written.
+// Returns false if the frame went out corrupted.
+unsigned char ws2812b::showFIFO(const unsigned int *wire) {
+	unsigned int i = 0;
+	unsigned char corrupted;
+
+	// The previous frame has to be out and latched before we touch the FIFO
+	waitForIdle();
+
+	// Set up PWM control registers. This also stops PWM (assuming it's running).
+	pwmWrite(PWM_CTL, PWMControlWord());
  
-	// Clear the FIFO
+	// Clear the FIFO, and whatever the last frame's drain left in PWM_STA
 	clearFIFO();
-	usleep(1000);
+	sampleErrors(false);
+	clearPWMErrors();
+	unsigned long long start = monotonicNs();
  
 	// printf("Before filling FIFO: ");
 	// dumpPWMStatus();
@@ -372,27 +1535,108 @@ void ws2812b::show() {
 	//dumpPWMBuffer();
     //printf("\n");
  
-	for(i=0; i<16; i++) {
-		// First, we have to reverse the bit order
-		PWMWaveform[i] = reverseWord(PWMWaveform[i]);
+	// Fill the FIFO before starting, so the serializer has a head start on us
+	while(i < PWMWaveformLength && !FIFOFull()) {
+		pwmWrite(PWM_FIF1, FIFOWord(wire, i++));
+	}
  
-		// That done, we add the word to the FIFO
-        //printf("Adding word to FIFO: ");
-        //printBinary(PWMWaveform[i], 32);
-        //printf("\n");
-		*(pwm + PWM_FIF1) = PWMWaveform[i];
-		//*(pwm + PWM_FIF1) = 0xACAC00F0; // A test pattern easily visible on an oscilloscope, but not WS2812 compatible
-		usleep(1000);
+	// Enable PWM, which will now read the waveform out of the FIFO
+	enablePWM(true);
+	frameDeadline = monotonicNs() + wireNs(stripWords) + LED_RESET_US * 1000ULL;
+
+	// Keep it topped up until the whole frame is in. If the FIFO runs empty while we still have
+	// data, the serializer has already sent a gap and the tail of the strip will be garbage.
+	while(i < PWMWaveformLength) {
+		if(!FIFOFull()) {
+			pwmWrite(PWM_FIF1, FIFOWord(wire, i++));
+		}
 	}
+
+	// Everything is in, but the tail is still draining. A gap before this point is a real one.
+	corrupted = sampleErrors(true);
+
+	unsigned long long elapsed = monotonicNs() - start;
+	beginStatsUpdate();
+	stats.fillNs += elapsed;
+	if(elapsed > stats.fillMaxNs) {
+		stats.fillMaxNs = elapsed;
+	}
+	endStatsUpdate();
  
 	// printf("After filling FIFO: ");
 	// dumpPWMStatus();
- 
-	// Enable PWM, which will now read the waveform out of the FIFO
-	enablePWM(true);
 
+	return !corrupted;
 }
 
+// Hand the whole of wire[] to the DMA controller, which feeds the FIFO as it drains. With verify,
+// waits until the DMA has delivered the last word and returns false if the frame went out
+// corrupted; otherwise returns straight after starting it.
+unsigned char ws2812b::showDMA(const unsigned int *wire, unsigned char verify) {
+
+	// The DMA may still be reading the previous frame
+	waitForIdle();
+
+	// Whatever went wrong with the last frame. Its drain sets GAPO, so that's not counted here.
+	sampleErrors(false);
+	unsigned long long start = monotonicNs();
+
+	// Copy the waveform into the DMA buffer, in FIFO order. The reset words at the end were zeroed
+	// in setupDMA() and stay that way.
+	if(numStrips == 1) {
+		memcpy(dmaWire, wire, PWMWaveformLength * sizeof(unsigned int));
+	} else {
+		unsigned int i;
+		for(i=0; i<stripWords; i++) {
+			dmaWire[2*i] = wire[i];
+			dmaWire[2*i + 1] = wire[stripWords + i];
+		}
+	}
+
+	// Stop PWM and start from an empty FIFO
+	pwmWrite(PWM_CTL, 0);
+	dmaWrite(DMA_CS, (1 << DMA_CS_INT) | (1 << DMA_CS_END));
+	clearFIFO();
+	clearPWMErrors();
+
+	// Ask for data when the FIFO drops to 7 words and panic below 3
+	pwmWrite(PWM_DMAC, (1 << PWM_DMAC_ENAB) | (3 << PWM_DMAC_PANIC) | (7 << PWM_DMAC_DREQ));
+
+	// Start PWM first; it idles until the DMA delivers the first word
+	pwmWrite(PWM_CTL, PWMControlWord());
+	enablePWM(true);
+
+	// Kick off the control block chain
+	dmaWrite(DMA_CONBLK_AD, dmaMemory.bus);
+	dmaWrite(DMA_CS, (1 << DMA_CS_WAIT_OUTSTANDING_WRITES) |
+	                 (15 << DMA_CS_PANIC_PRIORITY) |
+	                 (15 << DMA_CS_PRIORITY) |
+	                 (1 << DMA_CS_ACTIVE));
 
+	unsigned long long elapsed = monotonicNs() - start;
+	beginStatsUpdate();
+	stats.fillNs += elapsed;
+	if(elapsed > stats.fillMaxNs) {
+		stats.fillMaxNs = elapsed;
+	}
+	endStatsUpdate();
 
+	// The reset words at the end of dmaWire[] hold the line low for the latch time. With two strips
+	// the channels shift out their halves side by side.
+	frameDeadline = monotonicNs() + wireNs(dmaWireLength / numStrips);
 
+	if(!verify) {
+		return true;
+	}
+
+	// The DMA can't be done before the last FIFO load of words is all that's left to go out, so
+	// sleep until shortly before that and then watch for it. Once it's done the reset words are
+	// still in the FIFO: the natural drain hasn't set GAPO yet, and any gap seen is a real one.
+	unsigned long long wake = frameDeadline - wireNs(PWM_FIFO_LENGTH) - VERIFY_SLACK_US * 1000ULL;
+	if(monotonicNs() < wake) {
+		sleepUntilNs(wake);
+	}
+	unsigned long long timeout = frameDeadline + IDLE_TIMEOUT_US * 1000ULL;
+	while(DMAActive() && monotonicNs() < timeout);
+	return !sampleErrors(true);
+}
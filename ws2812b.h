@@ -11,15 +11,24 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
 
-// Base addresses for GPIO, PWM, and PWM clock.
+#include "peripheral.h"
+
+// Addresses for GPIO, PWM, and PWM clock, relative to where the peripherals start.
 // These will be "memory mapped" into virtual RAM so that they can be written and read directly.
+// The start depends on the model (0x20000000 on the Pi 1, 0x3F000000 on the Pi 2 and 3,
+// 0xFE000000 on the Pi 4) and is read from the device tree (see peripheralBase()); PERI_BASE is
+// only used if that can't be read.
 // -------------------------------------------------------------------------------------------------
 #define PERI_BASE       0x3F000000
-#define GPIO_BASE               (PERI_BASE + 0x200000) // GPIO controller
-#define PWM_BASE                (PERI_BASE + 0x20C000) // PWM controller
-#define CLOCK_BASE              (PERI_BASE + 0x101000) // PWM clock manager
-#define DMA_BASE                (PERI_BASE + 0x007000) // DMA controller
+#define GPIO_OFFSET             0x200000        // GPIO controller
+#define PWM_OFFSET              0x20C000        // PWM controller
+#define CLOCK_OFFSET            0x101000        // PWM clock manager
+#define DMA_OFFSET              0x007000        // DMA controller
 
 
 // Memory offsets for the PWM clock register, which is completely undocumented!
@@ -27,6 +36,17 @@
 #define PWM_CLK_CNTL 40         // Control (on/off)
 #define PWM_CLK_DIV  41         // Divisor (bits 11:0 are *quantized* floating part, 31:12 integer part)
 
+// PWM_CLK_CNTL bit offsets
+#define CM_PASSWD       0x5A000000      // Every write to a clock manager register must carry this
+#define CM_CNTL_MASH    9               // Bits 10:9. MASH filter stages, 0: integer division only
+#define CM_CNTL_BUSY    7               // Clock generator is running
+#define CM_CNTL_KILL    5               // Stop and reset the clock generator (may glitch the output)
+#define CM_CNTL_ENAB    4               // Enable the clock generator
+#define CM_CNTL_SRC     0               // Bits 3:0. Clock source
+
+// How long to wait for the clock generator to start or stop before giving up
+#define CM_BUSY_TIMEOUT_US 10000
+
 
 // PWM Register Addresses (page 141)
 // These are divided by 4 because the register offsets in the guide are in bytes (8 bits) but
@@ -87,6 +107,60 @@
 #define PWM_DMAC_DREQ   0       // Bits 7:0. Threshold for DREQ signal. Default 7.
 
 
+// DMA controller
+// --------------------------------------------------------------------------------------------------
+// Each channel has a 0x100-byte register block starting at DMA_OFFSET + channel * 0x100. The DMA
+// reads a chain of control blocks from memory; each control block describes one transfer and
+// holds the bus address of the next one (0 ends the chain). All addresses are *bus* addresses,
+// which is why the wire buffer has to come from the VideoCore mailbox (see mailbox.h).
+// Channels 7-14 are "lite" channels that can move at most 64K per control block.
+#define DMA_CHANNEL             10              // Not used by the firmware on the Pi 2
+#define DMA_CHANNEL_OFFSET(ch)  ((ch) * 0x100 / 4)
+#define DMA_ENABLE              (0xFF0 / 4)     // Global enable register (one bit per channel)
+
+#define DMA_CS          (0x00 / 4)      // Control and Status
+#define DMA_CONBLK_AD   (0x04 / 4)      // Control block address
+#define DMA_DEBUG       (0x20 / 4)      // Debug
+
+// DMA_CS bit offsets
+#define DMA_CS_RESET                    31      // Reset the channel
+#define DMA_CS_ABORT                    30      // Abort the current control block
+#define DMA_CS_WAIT_OUTSTANDING_WRITES  28      // Wait for AXI write responses before finishing
+#define DMA_CS_PANIC_PRIORITY           20      // Bits 23:20. AXI priority while PANIC is raised
+#define DMA_CS_PRIORITY                 16      // Bits 19:16. AXI priority
+#define DMA_CS_ERROR                    8       // An error occurred (details in DMA_DEBUG)
+#define DMA_CS_INT                      2       // Interrupt status (write 1 to clear)
+#define DMA_CS_END                      1       // Transfer complete (write 1 to clear)
+#define DMA_CS_ACTIVE                   0       // 1: Channel is running
+
+// Transfer information (DMA_TI, and the ti field of a control block) bit offsets
+#define DMA_TI_NO_WIDE_BURSTS   26      // Don't do wide writes as 2-beat bursts
+#define DMA_TI_PERMAP           16      // Bits 20:16. Peripheral that paces the transfer via DREQ
+#define DMA_TI_SRC_INC          8       // Increment the source address after each read
+#define DMA_TI_DEST_DREQ        6       // Pace writes with the DREQ selected in PERMAP
+#define DMA_TI_WAIT_RESP        3       // Wait for a write response before the next write
+
+#define DMA_PERMAP_PWM          5       // DREQ line of the PWM controller
+
+// Largest transfer a lite channel can do in one control block (a multiple of 4 bytes)
+#define DMA_MAX_CB_LENGTH       65532
+
+// Bus address of the PWM FIFO, as seen by the DMA controller
+#define PWM_BUS_BASE            0x7E20C000
+#define PWM_FIF1_BUS            (PWM_BUS_BASE + 0x18)
+
+// DMA control block. Must be 32-byte aligned.
+typedef struct dma_cb_t {
+	unsigned int ti;                // Transfer information
+	unsigned int source_ad;         // Source (bus) address
+	unsigned int dest_ad;           // Destination (bus) address
+	unsigned int txfr_len;          // Transfer length in bytes
+	unsigned int stride;            // 2D stride (unused)
+	unsigned int nextconbk;         // Bus address of the next control block, 0 to stop
+	unsigned int pad[2];
+} dma_cb_t;
+
+
 // PWM_RNG1, PWM_RNG2
 // --------------------------------------------------------------------------------------------------
 // Defines the transmission range. In PWM mode, evenly spaced pulses are sent within a period
@@ -124,58 +198,361 @@
 #define PAGE_SIZE (4*1024)
 #define BLOCK_SIZE (4*1024)
 
-// GPIO setup macros. Always use INP_GPIO(x) before using OUT_GPIO(x) or SET_GPIO_ALT(x,y)
-#define INP_GPIO(g) *(gpio+((g)/10)) &= ~(7<<(((g)%10)*3))
-#define OUT_GPIO(g) *(gpio+((g)/10)) |=  (1<<(((g)%10)*3))
-#define SET_GPIO_ALT(g,a) *(gpio+(((g)/10))) |= (((a)<=3?(a)+4:(a)==4?3:2)<<(((g)%10)*3))
-
-#define GPIO_SET *(gpio+7)  //   sets bits which are 1, ignores bits which are 0
-#define GPIO_CLR *(gpio+10) // clears bits which are 1, ignores bits which are 0
+// GPIO function select. Each GPFSEL register holds 3 bits for each of 10 pins.
+#define GPIO_FSEL_REG(g)        ((g)/10)
+#define GPIO_FSEL_SHIFT(g)      (((g)%10)*3)
+#define GPIO_FSEL_ALT(a)        ((a)<=3?(a)+4:(a)==4?3:2)       // Function select code for ALT0-ALT5
 
 // For convenience
 #define true 1
 #define false 0
 
-// PWM waveform buffer, 16 32-bit words - enough to hold 170 wire bits
-#define PWM_WAVEFORM_LENGTH 16
-
-#define LED_BUFFER_LENGTH 5
-
-// LED buffer (this will be translated into pulses in PWMWaveform[])
+// Depth of the PWM FIFO, in 32-bit words
+#define PWM_FIFO_LENGTH 16
+
+// LED data rates (see ws2812b::setWireFormat()). Anything in between, or a little above for
+// overclocking short runs, works too.
+#define DATA_RATE_WS2812B 800000        // The default
+#define DATA_RATE_WS2811  400000        // WS2811 in low speed mode
+
+// Wire bits per data bit. With 3, a 0 is 100 and a 1 is 110 (417 and 833 ns high at 800 kHz);
+// with 4 they're 1000 and 1110 (313 and 938 ns), and every color byte is exactly one word.
+#define SYMBOL_BITS_3 3                 // The default
+#define SYMBOL_BITS_4 4
+
+// Data rates setWireFormat() takes
+#define MIN_DATA_RATE 100000
+#define MAX_DATA_RATE 2000000
+
+// How far off the wanted rate the PWM clock may be with a plain integer divisor. Further off, a
+// fractional divisor is used, which needs the MASH filter and adds a little jitter.
+#define CLOCK_TOLERANCE 0.005
+
+// Low time that latches the data into the LEDs. The datasheet asks for at least 50 us.
+#define LED_RESET_US 55
+
+// How long to wait for the serializer to go idle after a frame should have finished
+#define IDLE_TIMEOUT_US 10000
+
+// Times a corrupted frame is sent again by default (see ws2812b::setRetryPolicy())
+#define DEFAULT_RETRIES 2
+
+// How early to wake up before a DMA frame can finish, to check it for errors
+#define VERIFY_SLACK_US 200
+
+// Words of wire data needed for n LEDs at symbolBits wire bits per data bit
+#define WIRE_WORDS_FOR(n, symbolBits) (((n) * 24 * (symbolBits) + 31) / 32)
+
+// Words of wire data needed for n LEDs with 3-bit symbols, the format of animation files
+#define WIRE_WORDS(n) WIRE_WORDS_FOR((n), SYMBOL_BITS_3)
+
+// Transmit modes (see setTransmitMode())
+#define TX_MODE_FIFO 0          // CPU writes the FIFO directly
+#define TX_MODE_DMA  1          // DMA streams the whole frame into the FIFO
+
+// Encoders (see setEncoder())
+#define ENCODER_SCALAR 0        // Table lookup, one color byte at a time
+#define ENCODER_NEON   1        // NEON, eight LEDs at a time (needs a NEON build, see encoder.h)
+
+// A sequence of frames already in wire format, ready to be replayed without encoding.
+// Frame n is words[n * frameLength] to words[(n + 1) * frameLength - 1] and stays on the LEDs for
+// intervalUs[n] microseconds (0: send the next one as soon as possible).
+typedef struct FrameSequence_t {
+	unsigned int frameLength;       // In 32-bit words
+	unsigned int numFrames;
+	unsigned int capacity;          // Frames allocated
+	unsigned int *words;
+	unsigned int *intervalUs;
+} FrameSequence_t;
+
+// A pre-encoded animation file mapped into memory (see animation.h)
+struct Animation_t;
+
+void initFrameSequence(FrameSequence_t *seq);
+void freeFrameSequence(FrameSequence_t *seq);
+
+// Range of LEDs [first, end) that changed since the wire buffer was last encoded from a buffer
+typedef struct DirtyRange_t {
+	unsigned int first;
+	unsigned int end;
+} DirtyRange_t;
+
+static inline void markDirty(DirtyRange_t *range, unsigned int first, unsigned int end) {
+	// An empty range (such as a cleared one being merged in) adds nothing
+	if(first >= end) {
+		return;
+	}
+	if(range->first >= range->end) {
+		range->first = first;
+		range->end = end;
+	} else {
+		if(first < range->first) range->first = first;
+		if(end > range->end) range->end = end;
+	}
+}
+
+static inline void clearDirty(DirtyRange_t *range) {
+	range->first = range->end = 0;
+}
+
+// Real-time scheduling for a thread (see ws2812b::setOutputThreadPolicy())
+unsigned char setThreadPolicy(pthread_t thread, int priority, int cpu);
+
+// Monotonic clock in nanoseconds
+static inline unsigned long long monotonicNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Sleep until the monotonic clock reaches ns
+static inline void sleepUntilNs(unsigned long long ns) {
+	struct timespec ts;
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0);
+}
+
+// Output statistics (see ws2812b::getStats()). Times are in nanoseconds.
+typedef struct OutputStats_t {
+	unsigned long long frames;      // Frames handed to the hardware
+	unsigned long long encodes;     // Times a dirty range was encoded
+	unsigned long long encodeNs;    // Time spent encoding
+	unsigned long long encodeMaxNs;
+	unsigned long long fillNs;      // Time spent feeding the FIFO or setting up the DMA
+	unsigned long long fillMaxNs;
+	unsigned long long waitNs;      // Time spent waiting for the previous frame to go out
+	unsigned long long gapErrors;   // Frames where the FIFO ran dry part way (GAPO1/GAPO2)
+	unsigned long long readErrors;  // FIFO read errors (RERR1)
+	unsigned long long writeErrors; // Writes to a full FIFO (WERR1)
+	unsigned long long busErrors;   // PWM bus errors (BERR)
+	unsigned long long dmaErrors;   // Frames where the DMA channel flagged an error
+	unsigned long long retransmits; // Frames sent again because they went out corrupted
+	unsigned long long corruptFrames;       // Frames still corrupted after the last retry
+} OutputStats_t;
+
+// Layout of the shared memory object written by ws2812b::publishStats(). The sequence number is
+// odd while the stats are being updated: copy them, then check it's even and hasn't changed.
+#define STATS_MAGIC     "W2SP"
+#define STATS_VERSION   2
+
+typedef struct StatsPage_t {
+	char magic[4];                  // STATS_MAGIC
+	unsigned int version;           // STATS_VERSION
+	volatile unsigned int sequence;
+	unsigned int numLEDs;
+	OutputStats_t stats;
+} StatsPage_t;
+
+// LED buffer (this will be translated into pulses in PWMWaveform[] by encodeWire())
 typedef struct Color_t {
         unsigned char r;
         unsigned char g;
         unsigned char b;
 } Color_t;
 
+// Color_t has to be exactly packed RGB, so a packed RGB frame can be loaded with one memcpy
+typedef char Color_t_must_be_packed_RGB[sizeof(Color_t) == 3 ? 1 : -1];
+
+// The LED buffers start on a cache line, so threads filling runs of 64 LEDs each (see effects.h)
+// never share one
+#define LED_BUFFER_ALIGN 64
+
+// 16 bits per channel, for dithering (see enableDithering())
+typedef struct Color16_t {
+	unsigned short r;
+	unsigned short g;
+	unsigned short b;
+} Color16_t;
+
+// Color correction for 16-bit pixels: a gamma curve, interpolated between 257 points, and a
+// per-channel scale (brightness times white balance, 65535: none)
+typedef struct DitherCurve_t {
+	unsigned short gamma[257];
+	unsigned int scale[3];
+} DitherCurve_t;
+
+// Color byte -> 24-bit (3-bit symbols) or 32-bit (4-bit symbols) wire pattern, one table per
+// channel so color correction can be folded into the encoding (see encoder.h)
+typedef struct WireTable_t {
+	unsigned int r[256];
+	unsigned int g[256];
+	unsigned int b[256];
+	unsigned int symbolBits;        // SYMBOL_BITS_*
+} WireTable_t;
+
 
 class ws2812b{
 	public:
-		ws2812b( unsigned int numLED );
+		ws2812b( unsigned int numLED, unsigned int numStrip = 1 );
+		~ws2812b();
+		void setTransmitMode(unsigned char mode);
+		unsigned char setEncoder(unsigned char type);
+		unsigned char setWireFormat(unsigned int dataRate, unsigned int symbolBits);
+		unsigned char setStrip2Pin(unsigned int pin);
+		void setBrightness(unsigned char level);
+		void setWhiteBalance(unsigned char r, unsigned char g, unsigned char b);
+		void setGamma(float gamma);
+		unsigned char setGamma(unsigned int strip, float gamma);
+		unsigned char enableDithering(unsigned char state);
+		unsigned char setPixelColor16(unsigned int pixel, unsigned short r, unsigned short g, unsigned short b);
+		unsigned char setPixels16(unsigned int first, unsigned int count, const Color16_t *pixels);
+		void setBackend(RegisterBackend *backend);
 		unsigned char setPixelColor(unsigned int pixel, unsigned char r, unsigned char g, unsigned char b);
-		void initHardware();
+		unsigned char setPixels(unsigned int first, unsigned int count, const Color_t *pixels);
+		unsigned char setPixelsRGB(unsigned int first, unsigned int count, const unsigned char *rgb);
+		unsigned char setPixelsRGBA(unsigned int first, unsigned int count, const unsigned char *rgba);
+		unsigned char fill(unsigned int first, unsigned int count, unsigned char r, unsigned char g, unsigned char b);
+		Color_t *pixelBuffer();
+		unsigned char pixelsChanged(unsigned int first, unsigned int count);
+		unsigned char initHardware();
         void clearLEDBuffer();
         void show();
+        unsigned long showAsync();
+        void waitForFrame(unsigned long frame);
+        void waitForFrame();
+        void waitForQueue();
+        void setFrameCallback(void (*callback)(void *arg, unsigned long frame), void *arg);
+        unsigned char setOutputThreadPolicy(int priority, int cpu);
+        unsigned char captureFrame(FrameSequence_t *seq, unsigned int intervalUs);
+        void playFrames(const FrameSequence_t *seq, unsigned int loops);
+        void playAnimation(const struct Animation_t *anim, unsigned int loops);
+        void showWire(const unsigned int *wire);
+        void setRetryPolicy(unsigned int retries);
+        void getStats(OutputStats_t *stats);
+        void resetStats();
+        unsigned char publishStats(const char *name);
 	
 	private:
 		unsigned int numLEDs;	// How many LEDs there are on the chain
 
-        // I/O access
-        volatile unsigned *gpio;
-        volatile unsigned *pwm;
-        volatile unsigned *clk;
-        volatile unsigned *dma;
+        // Strips. With two, LEDs 0 to stripLength-1 are on PWM channel 1 (GPIO18) and the rest on
+        // channel 2 (strip2Pin), which run side by side.
+        unsigned int numStrips;
+        unsigned int stripLength;       // LEDs on the first strip
+        unsigned int stripWords;        // Wire words per strip
+        unsigned int strip2Pin;
 
-        unsigned int PWMWaveform[PWM_WAVEFORM_LENGTH];
-
-        Color_t LEDBuffer[LED_BUFFER_LENGTH];
+        // I/O access
+        RegisterBackend *regs;
+        unsigned char sharedBackend;    // regs came from HardwareBackend::acquire()
+        unsigned char mapped;           // initHardware() got the registers mapped
+
+        unsigned int *PWMWaveform;      // Each strip's stripWords words in turn
+        unsigned int PWMWaveformLength;	// In 32-bit words
+
+        Color_t *LEDBuffer;             // Back buffer: what setPixelColor() writes to
+        Color_t *frontBuffer;           // Front buffer: the frame handed to the output thread
+
+        // Dirty ranges. PWMWaveform[] is kept between frames, so only LEDs that differ from the
+        // last frame encoded into it need re-encoding. backDirty/frontDirty are relative to it;
+        // carryDirty collects what the output thread encoded since the back buffer was last
+        // swapped, which the back buffer doesn't have yet.
+        DirtyRange_t backDirty;
+        DirtyRange_t frontDirty;
+        DirtyRange_t carryDirty;
+
+        unsigned char encoder;          // ENCODER_*
+
+        // Wire format (see setWireFormat())
+        unsigned int dataRate;          // LED data bits per second
+        unsigned int symbolBits;        // Wire bits per data bit
+        double wireBitRate;             // Serializer bits per second the clock actually gives
+        unsigned int resetWords;        // Zero words that hold the line low for LED_RESET_US
+
+        // Color correction, folded into one set of wire tables per strip. Changing it only
+        // rebuilds the tables and re-encodes; LEDBuffer[] keeps the uncorrected colors.
+        WireTable_t wireTables[2];
+        float stripGamma[2];            // Per strip, 1.0: none
+        unsigned char brightness;       // 0-255, all strips
+        unsigned char whiteBalance[3];  // R, G, B scale, 255: none
+        unsigned char correcting;       // The tables aren't the plain ones (rules out NEON)
+
+        // Dithering (see enableDithering()). The buffers are NULL while it's off.
+        Color16_t *deepBuffer;          // 16-bit copy of LEDBuffer[]
+        Color16_t *deepFront;           // 16-bit copy of frontBuffer[]
+        unsigned char *ditherError;     // What each LED still owes, 3 bytes per LED
+        DitherCurve_t ditherCurves[2];  // Color correction in 16 bits, per strip
+        WireTable_t plainTable;         // Dithered values are already corrected
+
+        // When the frame being sent will have been clocked out and latched (monotonicNs())
+        unsigned long long frameDeadline;
+
+        // Output thread (see showAsync())
+        pthread_t outputThread;
+        pthread_mutex_t outputLock;
+        pthread_cond_t outputCond;      // Timed against the monotonic clock, like frameDeadline
+        unsigned char outputThreadRunning;
+        unsigned char stopOutputThread;
+        unsigned char framePending;     // frontBuffer holds a frame the thread hasn't taken yet
+        unsigned char frontBusy;        // The thread is encoding from frontBuffer
+        unsigned long frameQueued;      // Number of the last frame passed to showAsync()
+        unsigned long frameSent;        // Number of the last frame handed to the hardware
+        unsigned long frameDone;        // Number of the last frame that has been clocked out
+        void (*frameCallback)(void *arg, unsigned long frame);
+        void *frameCallbackArg;
+        int outputPriority;             // SCHED_FIFO priority for the thread, 0: normal
+        int outputCPU;                  // CPU to pin the thread to, -1: any
+
+        // DMA transmit state
+        unsigned char transmitMode;
+        DMAMemory_t dmaMemory;          // Physically contiguous block holding the two below
+        dma_cb_t *dmaCB;                // Control block chain (at the start of the block)
+        unsigned int *dmaWire;          // Wire buffer (follows the control blocks)
+        unsigned int dmaWireLength;     // In 32-bit words, including the reset words
+        unsigned int maxRetries;        // Times a corrupted frame is sent again
+
+        // Statistics. Only the thread driving the hardware writes them (see beginStatsUpdate()).
+        OutputStats_t stats;
+        volatile unsigned int statsSequence;    // Odd while an update is going on
+        StatsPage_t *statsPage;         // Shared memory copy, NULL: not published
+        char statsPageName[64];
 	
-		volatile unsigned *mapRegisterMemory(int base);
-		void setupRegisterMemoryMappings();
+		unsigned int pwmRead(unsigned int reg) { return regs->read(REG_PWM, reg); }
+		void pwmWrite(unsigned int reg, unsigned int value) { regs->write(REG_PWM, reg, value); }
+		unsigned int clkRead(unsigned int reg) { return regs->read(REG_CLK, reg); }
+		void clkWrite(unsigned int reg, unsigned int value) { regs->write(REG_CLK, reg, value); }
+		unsigned int dmaRead(unsigned int reg) { return regs->read(REG_DMA, DMA_CHANNEL_OFFSET(DMA_CHANNEL) + reg); }
+		void dmaWrite(unsigned int reg, unsigned int value) { regs->write(REG_DMA, DMA_CHANNEL_OFFSET(DMA_CHANNEL) + reg, value); }
+		void setGPIOAlt(unsigned int pin, unsigned int alt);
+		unsigned char setupDMA();
+		void freeDMA();
+		unsigned char DMAActive();
+		void stopDMA();
+		unsigned char waitForClock(unsigned char busy);
+		unsigned char setupClock();
+		unsigned long long wireNs(unsigned int words) { return (unsigned long long)(words * 32 * 1e9 / wireBitRate); }
+		unsigned char hardwareBusy();
+		void waitForIdle();
+		void updateWireTables();
+		void encodeBackBuffer();
+		void encodeDirty(const Color_t *pixels, const Color16_t *deep, DirtyRange_t *dirty);
+		void copyToDeep(unsigned int first, unsigned int count);
+		void transmit(const unsigned int *wire);
+		void playWire(const unsigned int *words, unsigned int frameLength, unsigned int numFrames,
+		              const unsigned int *intervalUs, unsigned int fixedIntervalUs, unsigned int loops);
+		unsigned char showFIFO(const unsigned int *wire);
+		unsigned char showDMA(const unsigned int *wire, unsigned char verify);
+		unsigned char sampleErrors(unsigned char gaps);
+		void beginStatsUpdate();
+		void endStatsUpdate();
+		void unpublishStats();
+		static void *outputThreadEntry(void *arg);
+		void outputLoop();
+		void completeFrame(unsigned long frame);
 		void clearPWMBuffer();
 		void enablePWM(unsigned char state);
+		unsigned int PWMControlWord();
+
+		// Word i of the FIFO stream for wire[]. With two strips the FIFO feeds the channels
+		// alternately, so it takes a word from each strip in turn.
+		unsigned int FIFOWord(const unsigned int *wire, unsigned int i) {
+			return numStrips == 1 ? wire[i] : wire[(i & 1) * stripWords + (i >> 1)];
+		}
 		unsigned char FIFOEmpty();
+		unsigned char FIFOFull();
 		Color_t RGB2Color(unsigned char r, unsigned char g, unsigned char b);
+		unsigned char checkRange(unsigned int first, unsigned int count);
 		void printBinary(unsigned int i, unsigned int bits);
 		void setPWMBit(unsigned int bitPos, unsigned char bit);
 		unsigned char getPWMBit(unsigned int bitPos);